@@ -0,0 +1,586 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ * Scheduler of the transactions with many slaves on a RTU bus. The requests are
+ * queued, the contiguous reads of a slave are merged and each frame is sent
+ * once the bus has been quiet for the inter-frame gap.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "modbus-private.h"
+
+#include "modbus-rtu.h"
+
+/* Turnaround delay of the slaves after a broadcast (100 to 200 ms) */
+#define _MODBUS_BUS_BROADCAST_DELAY 100000
+
+/* Request queued to a slave of the bus */
+typedef struct _modbus_bus_request {
+    int id;
+    int slave;
+    int function;
+    int addr;
+    int nb;
+    /* Buffer of the values to read, owned by the application */
+    void *dest;
+    /* Values to write, allocated with the request */
+    uint8_t *src;
+    /* Result of the transaction and its errno */
+    int rc;
+    int error;
+    struct _modbus_bus_request *next;
+} modbus_bus_request_t;
+
+struct _modbus_bus {
+    modbus_t *ctx;
+    /* Silence before each frame in micro second (t3.5 by default) */
+    int gap;
+    int broadcast_delay;
+    int next_id;
+    /* Requests waiting for the bus, in order */
+    modbus_bus_request_t *queue;
+    modbus_bus_request_t *queue_tail;
+    int nb_queued;
+    /* Requests completed by the last transaction, not yet returned */
+    modbus_bus_request_t *done;
+    modbus_bus_request_t *done_tail;
+    /* Time from which the next frame can be sent */
+    struct timeval ready_time;
+};
+
+static void sleep_us(long us)
+{
+#ifdef _WIN32
+    Sleep(us / 1000);
+#else
+    struct timespec request, remaining;
+    request.tv_sec = us / 1000000;
+    request.tv_nsec = (us % 1000000) * 1000;
+    while (nanosleep(&request, &remaining) == -1 && errno == EINTR) {
+        request = remaining;
+    }
+#endif
+}
+
+/* Waits for the end of the gap after the last frame */
+static void wait_ready(modbus_bus_t *bus)
+{
+    struct timeval now;
+    long us;
+
+    _modbus_get_time(&now);
+    us = (bus->ready_time.tv_sec - now.tv_sec) * 1000000L +
+         (bus->ready_time.tv_usec - now.tv_usec);
+    if (us > 0)
+        sleep_us(us);
+}
+
+/* The bus is quiet from now, the next frame waits for the gap and delay */
+static void set_ready(modbus_bus_t *bus, int delay)
+{
+    _modbus_get_time(&bus->ready_time);
+    delay += bus->gap;
+    bus->ready_time.tv_sec += delay / 1000000;
+    bus->ready_time.tv_usec += delay % 1000000;
+    if (bus->ready_time.tv_usec >= 1000000) {
+        bus->ready_time.tv_sec++;
+        bus->ready_time.tv_usec -= 1000000;
+    }
+}
+
+static int is_read_function(int function)
+{
+    return function == MODBUS_FC_READ_COILS ||
+           function == MODBUS_FC_READ_DISCRETE_INPUTS ||
+           function == MODBUS_FC_READ_HOLDING_REGISTERS ||
+           function == MODBUS_FC_READ_INPUT_REGISTERS;
+}
+
+static int is_bits_function(int function)
+{
+    return function == MODBUS_FC_READ_COILS ||
+           function == MODBUS_FC_READ_DISCRETE_INPUTS ||
+           function == MODBUS_FC_WRITE_MULTIPLE_COILS;
+}
+
+modbus_bus_t *modbus_bus_new(modbus_t *ctx)
+{
+    modbus_bus_t *bus;
+
+    if (ctx == NULL || (ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_RTU &&
+                        ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_RTU_TCP)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    bus = (modbus_bus_t *) malloc(sizeof(modbus_bus_t));
+    if (bus == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    bus->ctx = ctx;
+    /* The device server keeps the gap on the serial line of a RTU over TCP
+       context */
+    if (ctx->backend->backend_type == _MODBUS_BACKEND_TYPE_RTU)
+        bus->gap = modbus_rtu_get_frame_silence(ctx);
+    else
+        bus->gap = 0;
+    bus->broadcast_delay = _MODBUS_BUS_BROADCAST_DELAY;
+    bus->next_id = 0;
+    bus->queue = NULL;
+    bus->queue_tail = NULL;
+    bus->nb_queued = 0;
+    bus->done = NULL;
+    bus->done_tail = NULL;
+    _modbus_get_time(&bus->ready_time);
+
+    return bus;
+}
+
+/* Sets the silence kept before each frame, 3.5 characters by default */
+int modbus_bus_set_gap(modbus_bus_t *bus, int us)
+{
+    if (bus == NULL || us < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    bus->gap = us;
+    return 0;
+}
+
+/* Sets the delay given to the slaves to process a broadcast request */
+int modbus_bus_set_broadcast_delay(modbus_bus_t *bus, int us)
+{
+    if (bus == NULL || us < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    bus->broadcast_delay = us;
+    return 0;
+}
+
+/* Queues a request and returns its ID. The values to write are copied. */
+static int queue_request(modbus_bus_t *bus,
+                         int slave,
+                         int function,
+                         int addr,
+                         int nb,
+                         int nb_max,
+                         void *dest,
+                         const void *src)
+{
+    modbus_bus_request_t *req;
+    size_t src_size = 0;
+
+    /* The values must be in the address space of 16 bits, so are the merged
+       reads */
+    if (bus == NULL || slave < 0 || slave > 247 || addr < 0 || nb < 1 || nb > nb_max ||
+        addr + nb > 0x10000 ||
+        (is_read_function(function) && (dest == NULL || slave == 0)) ||
+        (!is_read_function(function) && src == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (src != NULL)
+        src_size = is_bits_function(function) ? (size_t) nb : nb * sizeof(uint16_t);
+
+    req = (modbus_bus_request_t *) malloc(sizeof(modbus_bus_request_t) + src_size);
+    if (req == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    req->id = bus->next_id;
+    bus->next_id = (bus->next_id + 1) & 0x7FFFFFFF;
+    req->slave = slave;
+    req->function = function;
+    req->addr = addr;
+    req->nb = nb;
+    req->dest = dest;
+    req->src = NULL;
+    if (src != NULL) {
+        req->src = (uint8_t *) (req + 1);
+        memcpy(req->src, src, src_size);
+    }
+    req->rc = -1;
+    req->error = 0;
+    req->next = NULL;
+
+    if (bus->queue_tail != NULL)
+        bus->queue_tail->next = req;
+    else
+        bus->queue = req;
+    bus->queue_tail = req;
+    bus->nb_queued++;
+
+    return req->id;
+}
+
+int modbus_bus_read_bits(modbus_bus_t *bus, int slave, int addr, int nb, uint8_t *dest)
+{
+    return queue_request(
+        bus, slave, MODBUS_FC_READ_COILS, addr, nb, MODBUS_MAX_READ_BITS, dest, NULL);
+}
+
+int modbus_bus_read_input_bits(
+    modbus_bus_t *bus, int slave, int addr, int nb, uint8_t *dest)
+{
+    return queue_request(bus,
+                         slave,
+                         MODBUS_FC_READ_DISCRETE_INPUTS,
+                         addr,
+                         nb,
+                         MODBUS_MAX_READ_BITS,
+                         dest,
+                         NULL);
+}
+
+int modbus_bus_read_registers(
+    modbus_bus_t *bus, int slave, int addr, int nb, uint16_t *dest)
+{
+    return queue_request(bus,
+                         slave,
+                         MODBUS_FC_READ_HOLDING_REGISTERS,
+                         addr,
+                         nb,
+                         MODBUS_MAX_READ_REGISTERS,
+                         dest,
+                         NULL);
+}
+
+int modbus_bus_read_input_registers(
+    modbus_bus_t *bus, int slave, int addr, int nb, uint16_t *dest)
+{
+    return queue_request(bus,
+                         slave,
+                         MODBUS_FC_READ_INPUT_REGISTERS,
+                         addr,
+                         nb,
+                         MODBUS_MAX_READ_REGISTERS,
+                         dest,
+                         NULL);
+}
+
+int modbus_bus_write_bit(modbus_bus_t *bus, int slave, int addr, int status)
+{
+    uint8_t value = status ? ON : OFF;
+
+    return queue_request(
+        bus, slave, MODBUS_FC_WRITE_SINGLE_COIL, addr, 1, 1, NULL, &value);
+}
+
+int modbus_bus_write_register(modbus_bus_t *bus, int slave, int addr, uint16_t value)
+{
+    return queue_request(
+        bus, slave, MODBUS_FC_WRITE_SINGLE_REGISTER, addr, 1, 1, NULL, &value);
+}
+
+int modbus_bus_write_bits(
+    modbus_bus_t *bus, int slave, int addr, int nb, const uint8_t *src)
+{
+    return queue_request(bus,
+                         slave,
+                         MODBUS_FC_WRITE_MULTIPLE_COILS,
+                         addr,
+                         nb,
+                         MODBUS_MAX_WRITE_BITS,
+                         NULL,
+                         src);
+}
+
+int modbus_bus_write_registers(
+    modbus_bus_t *bus, int slave, int addr, int nb, const uint16_t *src)
+{
+    return queue_request(bus,
+                         slave,
+                         MODBUS_FC_WRITE_MULTIPLE_REGISTERS,
+                         addr,
+                         nb,
+                         MODBUS_MAX_WRITE_REGISTERS,
+                         NULL,
+                         src);
+}
+
+/* Removes the queued requests which can be merged with the read of first, in a
+   single read of [*start, *end[. The requests queued after a write to the slave
+   are not moved before it. */
+static modbus_bus_request_t *
+merge_reads(modbus_bus_t *bus, modbus_bus_request_t *first, int *start, int *end)
+{
+    modbus_bus_request_t *merged = first;
+    modbus_bus_request_t *merged_tail = first;
+    int nb_max = is_bits_function(first->function) ? MODBUS_MAX_READ_BITS
+                                                   : MODBUS_MAX_READ_REGISTERS;
+    int found;
+
+    *start = first->addr;
+    *end = first->addr + first->nb;
+
+    /* A request can become contiguous once another one is merged */
+    do {
+        modbus_bus_request_t *prev = NULL;
+        modbus_bus_request_t *req = bus->queue;
+
+        found = FALSE;
+        while (req != NULL) {
+            modbus_bus_request_t *next = req->next;
+            int req_end = req->addr + req->nb;
+
+            if (req->slave == first->slave && !is_read_function(req->function))
+                break;
+
+            if (req->slave == first->slave && req->function == first->function &&
+                req->addr <= *end && req_end >= *start &&
+                (req_end > *end ? req_end : *end) -
+                        (req->addr < *start ? req->addr : *start) <=
+                    nb_max) {
+                if (prev != NULL)
+                    prev->next = next;
+                else
+                    bus->queue = next;
+                if (bus->queue_tail == req)
+                    bus->queue_tail = prev;
+                bus->nb_queued--;
+
+                req->next = NULL;
+                merged_tail->next = req;
+                merged_tail = req;
+                if (req->addr < *start)
+                    *start = req->addr;
+                if (req_end > *end)
+                    *end = req_end;
+                found = TRUE;
+            } else {
+                prev = req;
+            }
+            req = next;
+        }
+    } while (found);
+
+    return merged;
+}
+
+/* Sends a write request to all the slaves, no response is expected */
+static int send_broadcast(modbus_t *ctx, modbus_bus_request_t *req)
+{
+    uint8_t raw[MODBUS_RTU_MAX_ADU_LENGTH];
+    int length = 0;
+    int i;
+
+    raw[length++] = MODBUS_BROADCAST_ADDRESS;
+    raw[length++] = req->function;
+    raw[length++] = req->addr >> 8;
+    raw[length++] = req->addr & 0xFF;
+
+    switch (req->function) {
+    case MODBUS_FC_WRITE_SINGLE_COIL:
+        raw[length++] = req->src[0] ? 0xFF : 0;
+        raw[length++] = 0;
+        break;
+    case MODBUS_FC_WRITE_SINGLE_REGISTER:
+        raw[length++] = ((uint16_t *) req->src)[0] >> 8;
+        raw[length++] = ((uint16_t *) req->src)[0] & 0xFF;
+        break;
+    case MODBUS_FC_WRITE_MULTIPLE_COILS:
+        raw[length++] = req->nb >> 8;
+        raw[length++] = req->nb & 0xFF;
+        raw[length++] = (req->nb / 8) + ((req->nb % 8) ? 1 : 0);
+        _modbus_pack_bits(raw + length, req->src, req->nb);
+        length += raw[6];
+        break;
+    default:
+        /* MODBUS_FC_WRITE_MULTIPLE_REGISTERS */
+        raw[length++] = req->nb >> 8;
+        raw[length++] = req->nb & 0xFF;
+        raw[length++] = req->nb * 2;
+        for (i = 0; i < req->nb; i++) {
+            raw[length++] = ((uint16_t *) req->src)[i] >> 8;
+            raw[length++] = ((uint16_t *) req->src)[i] & 0xFF;
+        }
+        break;
+    }
+
+    if (modbus_send_raw_request(ctx, raw, length) == -1)
+        return -1;
+
+    return req->nb;
+}
+
+static int run_write(modbus_t *ctx, modbus_bus_request_t *req)
+{
+    if (req->slave == MODBUS_BROADCAST_ADDRESS)
+        return send_broadcast(ctx, req);
+
+    switch (req->function) {
+    case MODBUS_FC_WRITE_SINGLE_COIL:
+        return modbus_write_bit(ctx, req->addr, req->src[0]);
+    case MODBUS_FC_WRITE_SINGLE_REGISTER:
+        return modbus_write_register(ctx, req->addr, ((uint16_t *) req->src)[0]);
+    case MODBUS_FC_WRITE_MULTIPLE_COILS:
+        return modbus_write_bits(ctx, req->addr, req->nb, req->src);
+    default:
+        return modbus_write_registers(ctx, req->addr, req->nb, (uint16_t *) req->src);
+    }
+}
+
+/* Runs the transaction of the first queued request, merged with the following
+   reads when possible. The completed requests are moved to the done list. */
+static void run_transaction(modbus_bus_t *bus)
+{
+    modbus_t *ctx = bus->ctx;
+    modbus_bus_request_t *req = bus->queue;
+    int rc;
+    int error = 0;
+
+    bus->queue = req->next;
+    if (bus->queue == NULL)
+        bus->queue_tail = NULL;
+    bus->nb_queued--;
+    req->next = NULL;
+
+    wait_ready(bus);
+
+    modbus_set_slave(ctx, req->slave);
+    if (is_read_function(req->function)) {
+        uint16_t registers[MODBUS_MAX_READ_REGISTERS];
+        uint8_t bits[MODBUS_MAX_READ_BITS];
+        modbus_bus_request_t *merged;
+        int start;
+        int end;
+
+        req = merge_reads(bus, req, &start, &end);
+        switch (req->function) {
+        case MODBUS_FC_READ_COILS:
+            rc = modbus_read_bits(ctx, start, end - start, bits);
+            break;
+        case MODBUS_FC_READ_DISCRETE_INPUTS:
+            rc = modbus_read_input_bits(ctx, start, end - start, bits);
+            break;
+        case MODBUS_FC_READ_HOLDING_REGISTERS:
+            rc = modbus_read_registers(ctx, start, end - start, registers);
+            break;
+        default:
+            rc = modbus_read_input_registers(ctx, start, end - start, registers);
+            break;
+        }
+        if (rc == -1)
+            error = errno;
+        set_ready(bus, 0);
+
+        /* Each request gets its part of the values */
+        for (merged = req; merged != NULL; merged = merged->next) {
+            if (rc == -1) {
+                merged->rc = -1;
+                merged->error = error;
+            } else if (is_bits_function(merged->function)) {
+                memcpy(merged->dest, bits + merged->addr - start, merged->nb);
+                merged->rc = merged->nb;
+            } else {
+                memcpy(merged->dest,
+                       registers + merged->addr - start,
+                       merged->nb * sizeof(uint16_t));
+                merged->rc = merged->nb;
+            }
+        }
+    } else {
+        rc = run_write(ctx, req);
+        if (rc == -1)
+            error = errno;
+        set_ready(bus, req->slave == MODBUS_BROADCAST_ADDRESS ? bus->broadcast_delay : 0);
+
+        req->rc = rc;
+        req->error = error;
+    }
+
+    if (bus->done_tail != NULL)
+        bus->done_tail->next = req;
+    else
+        bus->done = req;
+    while (req->next != NULL)
+        req = req->next;
+    bus->done_tail = req;
+}
+
+/* Returns the result of the next completed request, its ID is stored in id. The
+   queued requests are sent on the bus when no result is available. */
+int modbus_bus_complete(modbus_bus_t *bus, int *id)
+{
+    modbus_bus_request_t *req;
+    int rc;
+
+    if (bus == NULL || id == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *id = -1;
+
+    if (bus->done == NULL) {
+        if (bus->queue == NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+        run_transaction(bus);
+    }
+
+    req = bus->done;
+    bus->done = req->next;
+    if (bus->done == NULL)
+        bus->done_tail = NULL;
+
+    *id = req->id;
+    rc = req->rc;
+    if (rc == -1)
+        errno = req->error;
+    free(req);
+
+    return rc;
+}
+
+/* Returns the number of requests not yet sent on the bus */
+int modbus_bus_get_nb_queued(modbus_bus_t *bus)
+{
+    if (bus == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return bus->nb_queued;
+}
+
+/* Drops the requests not yet completed and frees the scheduler, the context
+   isn't freed. */
+void modbus_bus_free(modbus_bus_t *bus)
+{
+    modbus_bus_request_t *req;
+
+    if (bus == NULL)
+        return;
+
+    while (bus->queue != NULL) {
+        req = bus->queue;
+        bus->queue = req->next;
+        free(req);
+    }
+
+    while (bus->done != NULL) {
+        req = bus->done;
+        bus->done = req->next;
+        free(req);
+    }
+
+    free(bus);
+}
@@ -4,6 +4,7 @@
  * SPDX-License-Identifier: LGPL-2.1-or-later
  */
 
+#include <errno.h>
 #include <stdlib.h>
 
 // clang-format off
@@ -24,19 +25,171 @@
 
 #include <config.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define USE_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#  include <arm_neon.h>
+#  define USE_NEON
+#endif
+
+#include "modbus-private.h"
 #include "modbus.h"
 
 // clang-format on
 
-/* Sets many bits from a single byte value (all 8 bits of the byte value are
-   set) */
-void modbus_set_bits_from_byte(uint8_t *dest, int idx, const uint8_t value)
+/* Packs nb values (0 or not) of src in the bits of dest, the first value in
+   the least significant bit of the first byte. The unused bits of the last
+   byte are set to zero. */
+void _modbus_pack_bits(uint8_t *dest, const uint8_t *src, int nb)
+{
+    int i;
+    int shift;
+    uint8_t value;
+
+#if defined(USE_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+
+    /* 16 values to 2 bytes, the sign bits of the zero values are gathered */
+    for (; nb >= 16; nb -= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) src);
+        int mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+
+        *dest++ = mask & 0xFF;
+        *dest++ = (mask >> 8) & 0xFF;
+        src += 16;
+    }
+#elif defined(USE_NEON)
+    static const uint8_t weights[16] = {
+        1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    const uint8x16_t w = vld1q_u8(weights);
+
+    /* 16 values to 2 bytes, the weights of the non-zero values are summed */
+    for (; nb >= 16; nb -= 16) {
+        uint8x16_t v = vandq_u8(vtstq_u8(vld1q_u8(src), vld1q_u8(src)), w);
+
+        *dest++ = vaddv_u8(vget_low_u8(v));
+        *dest++ = vaddv_u8(vget_high_u8(v));
+        src += 16;
+    }
+#endif
+
+    for (; nb >= 8; nb -= 8) {
+        value = 0;
+        for (shift = 0; shift < 8; shift++)
+            value |= (src[shift] ? 1 : 0) << shift;
+        *dest++ = value;
+        src += 8;
+    }
+
+    if (nb > 0) {
+        value = 0;
+        for (i = 0; i < nb; i++)
+            value |= (src[i] ? 1 : 0) << i;
+        *dest = value;
+    }
+}
+
+/* Unpacks the nb first bits of src in dest, a byte (0 or 1) per bit */
+void _modbus_unpack_bits(uint8_t *dest, const uint8_t *src, int nb)
 {
     int i;
 
-    for (i = 0; i < 8; i++) {
-        dest[idx + i] = (value & (1 << i)) ? 1 : 0;
+#if defined(USE_SSE2)
+    const __m128i mask = _mm_set_epi8((char) 128, 64, 32, 16, 8, 4, 2, 1,
+                                      (char) 128, 64, 32, 16, 8, 4, 2, 1);
+    const __m128i one = _mm_set1_epi8(1);
+
+    /* 2 bytes to 16 values, each byte is spread over 8 lanes then tested */
+    for (; nb >= 16; nb -= 16) {
+        __m128i v = _mm_cvtsi32_si128(src[0] | (src[1] << 8));
+
+        v = _mm_unpacklo_epi8(v, v);
+        v = _mm_unpacklo_epi16(v, v);
+        v = _mm_unpacklo_epi32(v, v);
+        v = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(v, mask), mask), one);
+        _mm_storeu_si128((__m128i *) dest, v);
+        src += 2;
+        dest += 16;
+    }
+#elif defined(USE_NEON)
+    static const uint8_t masks[16] = {
+        1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    const uint8x16_t mask = vld1q_u8(masks);
+    const uint8x16_t one = vdupq_n_u8(1);
+
+    /* 2 bytes to 16 values, each byte is spread over 8 lanes then tested */
+    for (; nb >= 16; nb -= 16) {
+        uint8x16_t v = vcombine_u8(vdup_n_u8(src[0]), vdup_n_u8(src[1]));
+
+        vst1q_u8(dest, vandq_u8(vtstq_u8(v, mask), one));
+        src += 2;
+        dest += 16;
     }
+#endif
+
+    for (i = 0; i < nb; i++)
+        dest[i] = (src[i / 8] >> (i % 8)) & 1;
+}
+
+/* Copies nb bits of the packed array src from the bit start to dest (from its
+   first bit). The unused bits of the last byte are set to zero. */
+void _modbus_get_packed_bits(uint8_t *dest, const uint8_t *src, int start, int nb)
+{
+    int nb_bytes = (nb / 8) + ((nb % 8) ? 1 : 0);
+    int shift = start % 8;
+    int i;
+
+    src += start / 8;
+    if (shift == 0) {
+        memcpy(dest, src, nb_bytes);
+    } else {
+        /* Index of the last byte holding requested bits */
+        int last = (shift + nb - 1) / 8;
+
+        for (i = 0; i < nb_bytes; i++) {
+            int value = src[i] >> shift;
+
+            if (i < last)
+                value |= src[i + 1] << (8 - shift);
+            dest[i] = value & 0xFF;
+        }
+    }
+
+    if (nb % 8)
+        dest[nb_bytes - 1] &= (1 << (nb % 8)) - 1;
+}
+
+/* Copies nb bits of src (from its first bit) to the packed array dest from the
+   bit start, the other bits of dest are kept. */
+void _modbus_set_packed_bits(uint8_t *dest, int start, const uint8_t *src, int nb)
+{
+    int shift = start % 8;
+    int i = 0;
+
+    dest += start / 8;
+    if (shift == 0) {
+        /* The whole bytes are copied as is */
+        memcpy(dest, src, nb / 8);
+        i = nb / 8;
+    }
+
+    for (; i * 8 < nb; i++) {
+        int n = (nb - i * 8 < 8) ? nb - i * 8 : 8;
+        unsigned int mask = ((1 << n) - 1) << shift;
+        unsigned int value = (src[i] << shift) & mask;
+
+        dest[i] = (dest[i] & ~mask) | value;
+        if (mask >> 8)
+            dest[i + 1] = (dest[i + 1] & ~(mask >> 8)) | (value >> 8);
+    }
+}
+
+/* Sets many bits from a single byte value (all 8 bits of the byte value are
+   set) */
+void modbus_set_bits_from_byte(uint8_t *dest, int idx, const uint8_t value)
+{
+    _modbus_unpack_bits(dest + idx, &value, 8);
 }
 
 /* Sets many bits from a table of bytes (only the bits between idx and
@@ -46,22 +199,13 @@ void modbus_set_bits_from_bytes(uint8_t *dest,
                                 unsigned int nb_bits,
                                 const uint8_t *tab_byte)
 {
-    unsigned int i;
-    int shift = 0;
-
-    for (i = idx; i < idx + nb_bits; i++) {
-        dest[i] = tab_byte[(i - idx) / 8] & (1 << shift) ? 1 : 0;
-        /* gcc doesn't like: shift = (++shift) % 8; */
-        shift++;
-        shift %= 8;
-    }
+    _modbus_unpack_bits(dest + idx, tab_byte, nb_bits);
 }
 
 /* Gets the byte value from many bits.
    To obtain a full byte, set nb_bits to 8. */
 uint8_t modbus_get_byte_from_bits(const uint8_t *src, int idx, unsigned int nb_bits)
 {
-    unsigned int i;
     uint8_t value = 0;
 
     if (nb_bits > 8) {
@@ -70,9 +214,7 @@ uint8_t modbus_get_byte_from_bits(const uint8_t *src, int idx, unsigned int nb_b
         nb_bits = 8;
     }
 
-    for (i = 0; i < nb_bits; i++) {
-        value |= (src[idx + i] << i);
-    }
+    _modbus_pack_bits(&value, src + idx, nb_bits);
 
     return value;
 }
@@ -239,3 +381,189 @@ void modbus_set_float(float f, uint16_t *dest)
 {
     modbus_set_float_cdab(f, dest);
 }
+
+/* Converts nb values of width registers (2 or 4) between the registers and the
+   memory representation of the values. The first register holds the high-order
+   word unless the words are swapped, each register holds its bytes in the
+   high-order first unless the bytes are swapped. The conversion is its own
+   inverse so it's used to decode and to encode the values. */
+static int convert_values(
+    const void *src, int nb, void *dest, int width, modbus_value_order order)
+{
+    const uint16_t one = 1;
+    const uint8_t *s = (const uint8_t *) src;
+    uint8_t *d = (uint8_t *) dest;
+    int little_endian = (*(const uint8_t *) &one == 1);
+    int wire = (order & MODBUS_ORDER_WIRE) != 0;
+    int swap_words;
+    int swap_bytes;
+    int reverse;
+    int i, k;
+
+    order &= ~MODBUS_ORDER_WIRE;
+    if (src == NULL || dest == NULL || nb < 0 || order < MODBUS_ORDER_ABCD ||
+        order > MODBUS_ORDER_CDAB) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    swap_words = (order == MODBUS_ORDER_DCBA || order == MODBUS_ORDER_CDAB);
+    swap_bytes = (order == MODBUS_ORDER_DCBA || order == MODBUS_ORDER_BADC);
+    /* The big-endian registers are already swapped on a little-endian host */
+    if (wire && little_endian)
+        swap_bytes = !swap_bytes;
+    /* In the memory of a little-endian processor, the low-order word comes
+       first so the words are reversed unless they are already swapped */
+    reverse = little_endian ? !swap_words : swap_words;
+
+#if defined(USE_SSE2)
+    /* 16 bytes (4 or 2 values) per iteration */
+    for (; nb * width >= 8; nb -= 8 / width) {
+        __m128i v = _mm_loadu_si128((const __m128i *) s);
+
+        if (reverse) {
+            if (width == 2) {
+                v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+                v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+            } else {
+                v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+                v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+            }
+        }
+        if (swap_bytes)
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+
+        _mm_storeu_si128((__m128i *) d, v);
+        s += 16;
+        d += 16;
+    }
+#elif defined(USE_NEON)
+    /* 16 bytes (4 or 2 values) per iteration */
+    for (; nb * width >= 8; nb -= 8 / width) {
+        uint16x8_t v = vld1q_u16((const uint16_t *) s);
+
+        if (reverse)
+            v = (width == 2) ? vrev32q_u16(v) : vrev64q_u16(v);
+        if (swap_bytes)
+            v = vreinterpretq_u16_u8(vrev16q_u8(vreinterpretq_u8_u16(v)));
+
+        vst1q_u16((uint16_t *) d, v);
+        s += 16;
+        d += 16;
+    }
+#endif
+
+    for (i = 0; i < nb; i++) {
+        uint16_t words[4];
+        uint16_t value[4];
+
+        memcpy(words, s, width * 2);
+        for (k = 0; k < width; k++) {
+            uint16_t w = words[reverse ? width - 1 - k : k];
+            value[k] = swap_bytes ? (uint16_t) ((w << 8) | (w >> 8)) : w;
+        }
+        memcpy(d, value, width * 2);
+        s += width * 2;
+        d += width * 2;
+    }
+
+    return 0;
+}
+
+/* Decodes nb floats of 2 registers each from src */
+int modbus_get_float_array(const uint16_t *src,
+                           int nb,
+                           float *dest,
+                           modbus_value_order order)
+{
+    return convert_values(src, nb, dest, 2, order);
+}
+
+int modbus_get_double_array(const uint16_t *src,
+                            int nb,
+                            double *dest,
+                            modbus_value_order order)
+{
+    return convert_values(src, nb, dest, 4, order);
+}
+
+int modbus_get_int32_array(const uint16_t *src,
+                           int nb,
+                           int32_t *dest,
+                           modbus_value_order order)
+{
+    return convert_values(src, nb, dest, 2, order);
+}
+
+int modbus_get_uint32_array(const uint16_t *src,
+                            int nb,
+                            uint32_t *dest,
+                            modbus_value_order order)
+{
+    return convert_values(src, nb, dest, 2, order);
+}
+
+int modbus_get_int64_array(const uint16_t *src,
+                           int nb,
+                           int64_t *dest,
+                           modbus_value_order order)
+{
+    return convert_values(src, nb, dest, 4, order);
+}
+
+int modbus_get_uint64_array(const uint16_t *src,
+                            int nb,
+                            uint64_t *dest,
+                            modbus_value_order order)
+{
+    return convert_values(src, nb, dest, 4, order);
+}
+
+/* Encodes nb floats in 2 registers each to dest */
+int modbus_set_float_array(const float *src,
+                           int nb,
+                           uint16_t *dest,
+                           modbus_value_order order)
+{
+    return convert_values(src, nb, dest, 2, order);
+}
+
+int modbus_set_double_array(const double *src,
+                            int nb,
+                            uint16_t *dest,
+                            modbus_value_order order)
+{
+    return convert_values(src, nb, dest, 4, order);
+}
+
+int modbus_set_int32_array(const int32_t *src,
+                           int nb,
+                           uint16_t *dest,
+                           modbus_value_order order)
+{
+    return convert_values(src, nb, dest, 2, order);
+}
+
+int modbus_set_uint32_array(const uint32_t *src,
+                            int nb,
+                            uint16_t *dest,
+                            modbus_value_order order)
+{
+    return convert_values(src, nb, dest, 2, order);
+}
+
+int modbus_set_int64_array(const int64_t *src,
+                           int nb,
+                           uint16_t *dest,
+                           modbus_value_order order)
+{
+    return convert_values(src, nb, dest, 4, order);
+}
+
+int modbus_set_uint64_array(const uint64_t *src,
+                            int nb,
+                            uint16_t *dest,
+                            modbus_value_order order)
+{
+    return convert_values(src, nb, dest, 4, order);
+}
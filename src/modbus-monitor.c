@@ -0,0 +1,340 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ * Passive monitor of a RTU bus. The frames of the other devices are received
+ * without sending anything, each one is recognized as a request or a response
+ * by its length computed from the function code and its CRC.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "modbus-private.h"
+
+#include "modbus-rtu-private.h"
+#include "modbus-rtu.h"
+
+/* State of the monitor between the frames */
+typedef struct _modbus_monitor {
+    modbus_t *ctx;
+    /* Time to receive a character in micro second */
+    int onebyte_time;
+    /* Type expected for the next frame */
+    int expected;
+    /* Last request waiting for its response */
+    int req_slave;
+    int req_function;
+    int req_addr;
+    int req_nb;
+    struct timeval req_end;
+    /* End of the previous frame */
+    struct timeval last_end;
+    /* Time of the last character received, wall clock and monotonic */
+    uint64_t rx_timestamp;
+    struct timeval rx_time;
+} modbus_monitor_t;
+
+static uint64_t get_timestamp_us(void)
+{
+#if defined(_WIN32)
+    FILETIME ft;
+    uint64_t t;
+
+    /* 100 ns since 1601 */
+    GetSystemTimeAsFileTime(&ft);
+    t = ((uint64_t) ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    return t / 10 - 11644473600000000ULL;
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+static long diff_us(const struct timeval *end, const struct timeval *start)
+{
+    return (end->tv_sec - start->tv_sec) * 1000000L + (end->tv_usec - start->tv_usec);
+}
+
+static void sub_us(struct timeval *tv, long us)
+{
+    tv->tv_sec -= us / 1000000;
+    tv->tv_usec -= us % 1000000;
+    if (tv->tv_usec < 0) {
+        tv->tv_sec--;
+        tv->tv_usec += 1000000;
+    }
+}
+
+static int is_crc_valid(const uint8_t *msg, int msg_length)
+{
+    uint16_t crc;
+
+    if (msg_length < _MODBUS_RTU_HEADER_LENGTH + 1 + _MODBUS_RTU_CHECKSUM_LENGTH)
+        return FALSE;
+
+    crc = _modbus_crc16(msg, msg_length - 2);
+    return crc == ((msg[msg_length - 1] << 8) | msg[msg_length - 2]);
+}
+
+/* Returns the length of the frame of the type at the start of the data, 0 when
+   more data are required and -1 when the data can't be such a frame */
+static int match_frame(modbus_t *ctx, uint8_t *data, int length, int type)
+{
+    msg_type_t msg_type = type == MODBUS_RTU_FRAME_REQUEST ? MSG_INDICATION
+                                                           : MSG_CONFIRMATION;
+    int msg_length;
+
+    msg_length = _modbus_compute_msg_length(ctx, data, length, msg_type);
+    if (msg_length > MODBUS_RTU_MAX_ADU_LENGTH)
+        return -1;
+
+    if (msg_length > length)
+        return 0;
+
+    /* The length is known, the function code is checked by the CRC */
+    msg_length = _modbus_compute_msg_length(ctx, data, msg_length, msg_type);
+    if (msg_length > length)
+        return 0;
+
+    return is_crc_valid(data, msg_length) ? msg_length : -1;
+}
+
+/* Decodes the frame and calls the callback, returns its result */
+static int emit_frame(modbus_monitor_t *monitor,
+                      uint8_t *data,
+                      int length,
+                      int type,
+                      int remaining,
+                      modbus_rtu_monitor_t callback,
+                      void *user_data)
+{
+    modbus_rtu_frame_t frame;
+    struct timeval start, end;
+    int function;
+
+    frame.type = type;
+    frame.slave = data[0];
+    frame.function = length > 1 ? data[1] : -1;
+    frame.exception_code = 0;
+    frame.addr = -1;
+    frame.nb = -1;
+    frame.crc_valid = type != MODBUS_RTU_FRAME_UNKNOWN;
+    frame.response_time = -1;
+    frame.data = data;
+    frame.length = length;
+
+    /* Time of the first and after the last characters, estimated from the
+       time of the last character received. The frames can't overlap when the
+       driver delivers the characters faster than the baud rate. */
+    end = monitor->rx_time;
+    sub_us(&end, (long) remaining * monitor->onebyte_time);
+    if (diff_us(&end, &monitor->last_end) < 0)
+        end = monitor->last_end;
+    start = end;
+    sub_us(&start, (long) length * monitor->onebyte_time);
+    if (diff_us(&start, &monitor->last_end) < 0)
+        start = monitor->last_end;
+    monitor->last_end = end;
+    frame.timestamp = monitor->rx_timestamp - diff_us(&monitor->rx_time, &start);
+
+    function = frame.function;
+    if (type == MODBUS_RTU_FRAME_REQUEST) {
+        if (function <= MODBUS_FC_WRITE_SINGLE_REGISTER ||
+            function == MODBUS_FC_WRITE_MULTIPLE_COILS ||
+            function == MODBUS_FC_WRITE_MULTIPLE_REGISTERS ||
+            function == MODBUS_FC_MASK_WRITE_REGISTER ||
+            function == MODBUS_FC_WRITE_AND_READ_REGISTERS) {
+            frame.addr = (data[2] << 8) | data[3];
+            if (function == MODBUS_FC_WRITE_SINGLE_COIL ||
+                function == MODBUS_FC_WRITE_SINGLE_REGISTER ||
+                function == MODBUS_FC_MASK_WRITE_REGISTER) {
+                frame.nb = 1;
+            } else {
+                frame.nb = (data[4] << 8) | data[5];
+            }
+        }
+
+        /* No response to a broadcast */
+        if (frame.slave != MODBUS_BROADCAST_ADDRESS) {
+            monitor->expected = MODBUS_RTU_FRAME_RESPONSE;
+            monitor->req_slave = frame.slave;
+            monitor->req_function = function;
+            monitor->req_addr = frame.addr;
+            monitor->req_nb = frame.nb;
+            monitor->req_end = end;
+        }
+    } else {
+        if (type == MODBUS_RTU_FRAME_RESPONSE) {
+            if (function & 0x80)
+                frame.exception_code = data[2];
+
+            /* Response to the last request */
+            if (monitor->expected == MODBUS_RTU_FRAME_RESPONSE &&
+                frame.slave == monitor->req_slave &&
+                (function & 0x7F) == monitor->req_function) {
+                frame.addr = monitor->req_addr;
+                frame.nb = monitor->req_nb;
+                frame.response_time = diff_us(&start, &monitor->req_end);
+                if (frame.response_time < 0)
+                    frame.response_time = 0;
+            }
+        }
+        monitor->expected = MODBUS_RTU_FRAME_REQUEST;
+    }
+
+    if (monitor->ctx->debug) {
+        int i;
+
+        printf("%s frame (%s):",
+               type == MODBUS_RTU_FRAME_REQUEST    ? "Request"
+               : type == MODBUS_RTU_FRAME_RESPONSE ? "Response"
+                                                   : "Unknown",
+               frame.crc_valid ? "CRC OK" : "bad CRC");
+        for (i = 0; i < length; i++)
+            printf(" <%.2X>", data[i]);
+        printf("\n");
+    }
+
+    return callback(monitor->ctx, &frame, user_data);
+}
+
+/* Monitors the RTU bus, the callback is called for each frame received until
+   it returns a non-zero value */
+int modbus_rtu_monitor(modbus_t *ctx, modbus_rtu_monitor_t callback, void *user_data)
+{
+    modbus_rtu_t *ctx_rtu;
+    modbus_monitor_t monitor;
+    uint8_t buf[_MODBUS_RX_BUFFER_LENGTH];
+    struct timeval silence;
+    struct timeval tv;
+    struct timeval *p_tv;
+    int length = 0;
+    int rc;
+
+    if (ctx == NULL || callback == NULL ||
+        ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_RTU) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (!ctx->backend->is_connected(ctx)) {
+        errno = EBADF;
+        return -1;
+    }
+
+    ctx_rtu = (modbus_rtu_t *) ctx->backend_data;
+    memset(&monitor, 0, sizeof(monitor));
+    monitor.ctx = ctx;
+    monitor.onebyte_time =
+        1000000 *
+        (1 + ctx_rtu->data_bit + (ctx_rtu->parity == 'N' ? 0 : 1) + ctx_rtu->stop_bit) /
+        ctx_rtu->baud;
+    monitor.expected = MODBUS_RTU_FRAME_REQUEST;
+
+    /* The silence ends the frames which aren't recognized */
+    rc = modbus_rtu_get_frame_silence(ctx);
+    silence.tv_sec = rc / 1000000;
+    silence.tv_usec = rc % 1000000;
+
+    /* The data received in advance by the context are monitored too */
+    if (ctx->rx_length > 0) {
+        memcpy(buf, ctx->rx_buf + ctx->rx_start, ctx->rx_length);
+        length = ctx->rx_length;
+        ctx->rx_start = 0;
+        ctx->rx_length = 0;
+        ctx->rx_crc = _MODBUS_CRC16_INIT;
+        ctx->rx_crc_length = 0;
+        _modbus_get_time(&monitor.rx_time);
+        monitor.rx_timestamp = get_timestamp_us();
+    }
+
+    for (;;) {
+        /* Extracts the frames recognized at the start of the buffer */
+        while (length > 0) {
+            int other = monitor.expected == MODBUS_RTU_FRAME_REQUEST
+                            ? MODBUS_RTU_FRAME_RESPONSE
+                            : MODBUS_RTU_FRAME_REQUEST;
+            int expected_length = match_frame(ctx, buf, length, monitor.expected);
+            int other_length = match_frame(ctx, buf, length, other);
+            int type;
+            int frame_length;
+
+            if (expected_length > 0) {
+                type = monitor.expected;
+                frame_length = expected_length;
+            } else if (other_length > 0) {
+                type = other;
+                frame_length = other_length;
+            } else if (length < MODBUS_RTU_MAX_ADU_LENGTH) {
+                /* Waits for the end of the frame or for the silence after the
+                   data which aren't a valid frame */
+                break;
+            } else {
+                /* Too many data without a valid frame, the silence is missed */
+                type = MODBUS_RTU_FRAME_UNKNOWN;
+                frame_length = MODBUS_RTU_MAX_ADU_LENGTH;
+            }
+
+            rc = emit_frame(&monitor,
+                            buf,
+                            frame_length,
+                            type,
+                            length - frame_length,
+                            callback,
+                            user_data);
+            length -= frame_length;
+            memmove(buf, buf + frame_length, length);
+            if (rc != 0)
+                return 0;
+        }
+
+        if (length > 0) {
+            tv = silence;
+            p_tv = &tv;
+        } else if (ctx->indication_timeout.tv_sec > 0 ||
+                   ctx->indication_timeout.tv_usec > 0) {
+            tv = ctx->indication_timeout;
+            p_tv = &tv;
+        } else {
+            /* Wait for a frame without timeout */
+            p_tv = NULL;
+        }
+
+        rc = ctx->backend->select(ctx, p_tv, length > 0 ? 1 : 2);
+        if (rc == -1 && errno == ETIMEDOUT && length > 0) {
+            /* The bus is quiet, the data aren't a valid frame */
+            rc = emit_frame(
+                &monitor, buf, length, MODBUS_RTU_FRAME_UNKNOWN, 0, callback, user_data);
+            length = 0;
+            if (rc != 0)
+                return 0;
+            continue;
+        }
+        if (rc == -1) {
+            _error_print(ctx, "select");
+            return -1;
+        }
+
+        rc = ctx->backend->recv(ctx, buf + length, (int) sizeof(buf) - length);
+        if (rc == 0) {
+            errno = ECONNRESET;
+            rc = -1;
+        }
+        if (rc == -1) {
+            _error_print(ctx, "read");
+            return -1;
+        }
+        length += rc;
+        _modbus_get_time(&monitor.rx_time);
+        monitor.rx_timestamp = get_timestamp_us();
+    }
+}
@@ -37,13 +37,30 @@ MODBUS_BEGIN_DECLS
 
 #define _MODBUS_EXCEPTION_RSP_LENGTH 5
 
+/* Size of the receive buffer, many messages can be read at once */
+#define _MODBUS_RX_BUFFER_LENGTH (4 * MODBUS_MAX_ADU_LENGTH)
+
+/* Initial value of the CRC of the RTU frames */
+#define _MODBUS_CRC16_INIT 0xFFFF
+
+/* Events of _modbus_wait */
+#define _MODBUS_WAIT_READ  1
+#define _MODBUS_WAIT_WRITE 2
+
+/* Atomic builtins of GCC and Clang used by the synchronized mappings */
+#if defined(__GNUC__) || defined(__clang__)
+#define _MODBUS_HAVE_ATOMICS 1
+#endif
+
 /* Timeouts in microsecond (0.5 s) */
 #define _RESPONSE_TIMEOUT 500000
 #define _BYTE_TIMEOUT     500000
 
 typedef enum {
     _MODBUS_BACKEND_TYPE_RTU = 0,
-    _MODBUS_BACKEND_TYPE_TCP
+    _MODBUS_BACKEND_TYPE_TCP,
+    /* RTU frames, CRC included, over a TCP connection */
+    _MODBUS_BACKEND_TYPE_RTU_TCP
 } modbus_backend_type_t;
 
 /*
@@ -66,6 +83,89 @@ typedef struct _sft {
     int t_id;
 } sft_t;
 
+/* Transaction sent by a modbus_send_* function and waiting for its
+   confirmation. The beginning of the request is kept to check the response. */
+typedef struct _modbus_pending {
+    int tid;
+    /* Number of values to decode (bits or registers) */
+    int nb;
+    void *dest;
+    struct timeval deadline;
+    uint8_t req[_MIN_REQ_LENGTH];
+} modbus_pending_t;
+
+/* Range of a segmented mapping, the values are stored in the table from index */
+typedef struct _modbus_mapping_segment {
+    int start;
+    int nb;
+    int index;
+} modbus_mapping_segment_t;
+
+/* The function codes which can be replied by a handler are lower */
+#define _MODBUS_NB_REPLY_HANDLERS (MODBUS_FC_WRITE_MULTIPLE_REGISTERS + 1)
+
+typedef struct _modbus_reply_handler_entry {
+    modbus_reply_handler_t handler;
+    void *user_data;
+} modbus_reply_handler_entry_t;
+
+/* Response of a request deferred by its handler (see modbus_reply_defer) */
+struct _modbus_deferred {
+    /* Context of the request, the context of the connection in a server */
+    modbus_t *ctx;
+    sft_t sft;
+    /* Values to read, in rsp */
+    uint8_t *dest;
+    int rsp_length;
+    /* Broadcast request without response */
+    int suppressed;
+    /* Completed responses queued to the server */
+    struct _modbus_deferred *next;
+    uint8_t rsp[MODBUS_MAX_ADU_LENGTH];
+};
+
+/* Response being built around the call of a reply handler */
+typedef struct _modbus_handler_call {
+    sft_t sft;
+    const uint8_t *rsp;
+    int rsp_length;
+    uint8_t *dest;
+    int suppressed;
+    modbus_deferred_t *deferred;
+} modbus_handler_call_t;
+
+/* Internal data of the mappings allocated with options */
+typedef struct _modbus_mapping_ext {
+    /* Sequence lock, the counter is odd while a writer updates the mapping */
+    unsigned int seq;
+    /* Segments sorted by address of each table (modbus_table) */
+    modbus_mapping_segment_t *segments[4];
+    int nb_segments[4];
+    /* Region of a shared mapping, the sequence lock is in its header */
+    void *shm;
+    size_t shm_size;
+} modbus_mapping_ext_t;
+
+/* "MBSH" */
+#define _MODBUS_SHM_MAGIC   0x4D425348
+#define _MODBUS_SHM_VERSION 1
+
+/* Header of a mapping in shared memory, followed by the tables */
+typedef struct _modbus_mapping_shm_header {
+    uint32_t magic;
+    uint32_t version;
+    /* Size of the region */
+    uint32_t size;
+    /* Options of the mapping (modbus_mapping_flags) */
+    uint32_t flags;
+    /* Sequence lock shared by the processes (MODBUS_MAPPING_SYNC) */
+    unsigned int seq;
+    /* Layout of each table (modbus_table), offset from the header */
+    uint32_t start[4];
+    uint32_t nb[4];
+    uint32_t offset[4];
+} modbus_mapping_shm_header_t;
+
 typedef struct _modbus_backend {
     unsigned int backend_type;
     unsigned int header_length;
@@ -89,7 +189,7 @@ typedef struct _modbus_backend {
     unsigned int (*is_connected)(modbus_t *ctx);
     void (*close)(modbus_t *ctx);
     int (*flush)(modbus_t *ctx);
-    int (*select)(modbus_t *ctx, fd_set *rset, struct timeval *tv, int msg_length);
+    int (*select)(modbus_t *ctx, struct timeval *tv, int msg_length);
     void (*free)(modbus_t *ctx);
 } modbus_backend_t;
 
@@ -106,11 +206,56 @@ struct _modbus {
     struct timeval indication_timeout;
     const modbus_backend_t *backend;
     void *backend_data;
+    /* Transactions in flight */
+    modbus_pending_t *pending;
+    int nb_pending;
+    int max_pending;
+    /* Data received in advance, rx_length bytes from rx_start */
+    uint8_t rx_buf[_MODBUS_RX_BUFFER_LENGTH];
+    int rx_start;
+    int rx_length;
+    /* CRC of the first rx_crc_length bytes of the message being received */
+    uint16_t rx_crc;
+    int rx_crc_length;
+    /* Silence which ends the frame being received, disabled when 0 (RTU) */
+    struct timeval rx_silence;
+    /* Read ahead the indications (the context is dedicated to one connection) */
+    int indication_read_ahead;
+    /* Driven by an event loop, the context must never sleep */
+    int event_driven;
+    /* Handlers indexed by function code, NULL if none has been set */
+    modbus_reply_handler_entry_t *reply_handlers;
+    /* Call of a reply handler in progress, NULL otherwise */
+    modbus_handler_call_t *handler_call;
+    /* Connection of the server engine owning the context, NULL otherwise */
+    void *server_conn;
 };
 
 void _modbus_init_common(modbus_t *ctx);
 void _error_print(modbus_t *ctx, const char *context);
 int _modbus_receive_msg(modbus_t *ctx, uint8_t *msg, msg_type_t msg_type);
+int _modbus_poll_msg(modbus_t *ctx, uint8_t *msg, msg_type_t msg_type);
+int _modbus_compute_msg_length(modbus_t *ctx,
+                               uint8_t *msg,
+                               int msg_length,
+                               msg_type_t msg_type);
+int _modbus_build_reply(modbus_t *ctx,
+                        const uint8_t *req,
+                        int req_length,
+                        modbus_mapping_t *mb_mapping,
+                        uint8_t *rsp);
+int _modbus_wait(int fd, int events, struct timeval *tv);
+void _modbus_get_time(struct timeval *tv);
+int _modbus_is_write_function(int function);
+void _modbus_pack_bits(uint8_t *dest, const uint8_t *src, int nb);
+void _modbus_unpack_bits(uint8_t *dest, const uint8_t *src, int nb);
+void _modbus_get_packed_bits(uint8_t *dest, const uint8_t *src, int start, int nb);
+void _modbus_set_packed_bits(uint8_t *dest, int start, const uint8_t *src, int nb);
+void _modbus_server_defer(modbus_deferred_t *deferred);
+int _modbus_server_complete(modbus_deferred_t *deferred);
+void _modbus_mapping_unmap_shm(modbus_mapping_ext_t *ext);
+uint16_t _modbus_crc16(const uint8_t *buffer, int buffer_length);
+uint16_t _modbus_crc16_update(uint16_t crc, const uint8_t *buffer, int buffer_length);
 
 #ifndef HAVE_STRLCPY
 size_t strlcpy(char *dest, const char *src, size_t dest_size);
@@ -60,6 +60,13 @@ typedef struct _modbus_rtu {
 #else
     /* Save old termios settings */
     struct termios old_tios;
+    /* Low latency options requested and applied to the port */
+    int low_latency;
+    int low_latency_applied;
+    /* Low latency flag of the driver before connection, -1 if unknown */
+    int old_driver_low_latency;
+    /* Current VMIN of the port */
+    int vmin;
 #endif
 #if HAVE_DECL_TIOCSRS485
     int serial_mode;
@@ -69,9 +76,28 @@ typedef struct _modbus_rtu {
     int rts_delay;
     int onebyte_time;
     void (*set_rts)(modbus_t *ctx, int on);
+    /* End of transmission before to release RTS (MODBUS_RTU_TX_WAIT_*) */
+    int tx_wait;
 #endif
     /* To handle many slaves on the same link */
     int confirmation_to_ignore;
+    /* Delimitation of the received frames (MODBUS_RTU_FRAMING_*) */
+    int framing;
+    /* Silence in micro second which ends a frame (t3.5) */
+    int frame_silence;
 } modbus_rtu_t;
 
+/* Framing of the RTU frames, shared with the RTU over TCP backend */
+int _modbus_rtu_set_slave(modbus_t *ctx, int slave);
+int _modbus_rtu_build_request_basis(
+    modbus_t *ctx, int function, int addr, int nb, uint8_t *req);
+int _modbus_rtu_build_response_basis(sft_t *sft, uint8_t *rsp);
+int _modbus_rtu_get_response_tid(const uint8_t *req);
+int _modbus_rtu_send_msg_pre(uint8_t *req, int req_length);
+int _modbus_rtu_check_integrity(modbus_t *ctx, uint8_t *msg, const int msg_length);
+int _modbus_rtu_pre_check_confirmation(modbus_t *ctx,
+                                       const uint8_t *req,
+                                       const uint8_t *rsp,
+                                       int rsp_length);
+
 #endif /* MODBUS_RTU_PRIVATE_H */
@@ -18,61 +18,17 @@
 #include "modbus-rtu-private.h"
 #include "modbus-rtu.h"
 
-#if HAVE_DECL_TIOCSRS485 || HAVE_DECL_TIOCM_RTS
+#if HAVE_DECL_TIOCSRS485 || HAVE_DECL_TIOCM_RTS || HAVE_DECL_TIOCGSERIAL
 #include <sys/ioctl.h>
 #endif
 
-#if HAVE_DECL_TIOCSRS485
+#if HAVE_DECL_TIOCSRS485 || HAVE_DECL_ASYNC_LOW_LATENCY
 #include <linux/serial.h>
 #endif
 
-/* Table of CRC values for high-order byte */
-static const uint8_t table_crc_hi[] = {
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1,
-    0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40,
-    0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1,
-    0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1,
-    0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
-    0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1,
-    0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
-    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0,
-    0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40,
-    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0,
-    0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1,
-    0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
-    0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0,
-    0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0,
-    0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40};
-
-/* Table of CRC values for low-order byte */
-static const uint8_t table_crc_lo[] = {
-    0x00, 0xC0, 0xC1, 0x01, 0xC3, 0x03, 0x02, 0xC2, 0xC6, 0x06, 0x07, 0xC7, 0x05, 0xC5,
-    0xC4, 0x04, 0xCC, 0x0C, 0x0D, 0xCD, 0x0F, 0xCF, 0xCE, 0x0E, 0x0A, 0xCA, 0xCB, 0x0B,
-    0xC9, 0x09, 0x08, 0xC8, 0xD8, 0x18, 0x19, 0xD9, 0x1B, 0xDB, 0xDA, 0x1A, 0x1E, 0xDE,
-    0xDF, 0x1F, 0xDD, 0x1D, 0x1C, 0xDC, 0x14, 0xD4, 0xD5, 0x15, 0xD7, 0x17, 0x16, 0xD6,
-    0xD2, 0x12, 0x13, 0xD3, 0x11, 0xD1, 0xD0, 0x10, 0xF0, 0x30, 0x31, 0xF1, 0x33, 0xF3,
-    0xF2, 0x32, 0x36, 0xF6, 0xF7, 0x37, 0xF5, 0x35, 0x34, 0xF4, 0x3C, 0xFC, 0xFD, 0x3D,
-    0xFF, 0x3F, 0x3E, 0xFE, 0xFA, 0x3A, 0x3B, 0xFB, 0x39, 0xF9, 0xF8, 0x38, 0x28, 0xE8,
-    0xE9, 0x29, 0xEB, 0x2B, 0x2A, 0xEA, 0xEE, 0x2E, 0x2F, 0xEF, 0x2D, 0xED, 0xEC, 0x2C,
-    0xE4, 0x24, 0x25, 0xE5, 0x27, 0xE7, 0xE6, 0x26, 0x22, 0xE2, 0xE3, 0x23, 0xE1, 0x21,
-    0x20, 0xE0, 0xA0, 0x60, 0x61, 0xA1, 0x63, 0xA3, 0xA2, 0x62, 0x66, 0xA6, 0xA7, 0x67,
-    0xA5, 0x65, 0x64, 0xA4, 0x6C, 0xAC, 0xAD, 0x6D, 0xAF, 0x6F, 0x6E, 0xAE, 0xAA, 0x6A,
-    0x6B, 0xAB, 0x69, 0xA9, 0xA8, 0x68, 0x78, 0xB8, 0xB9, 0x79, 0xBB, 0x7B, 0x7A, 0xBA,
-    0xBE, 0x7E, 0x7F, 0xBF, 0x7D, 0xBD, 0xBC, 0x7C, 0xB4, 0x74, 0x75, 0xB5, 0x77, 0xB7,
-    0xB6, 0x76, 0x72, 0xB2, 0xB3, 0x73, 0xB1, 0x71, 0x70, 0xB0, 0x50, 0x90, 0x91, 0x51,
-    0x93, 0x53, 0x52, 0x92, 0x96, 0x56, 0x57, 0x97, 0x55, 0x95, 0x94, 0x54, 0x9C, 0x5C,
-    0x5D, 0x9D, 0x5F, 0x9F, 0x9E, 0x5E, 0x5A, 0x9A, 0x9B, 0x5B, 0x99, 0x59, 0x58, 0x98,
-    0x88, 0x48, 0x49, 0x89, 0x4B, 0x8B, 0x8A, 0x4A, 0x4E, 0x8E, 0x8F, 0x4F, 0x8D, 0x4D,
-    0x4C, 0x8C, 0x44, 0x84, 0x85, 0x45, 0x87, 0x47, 0x46, 0x86, 0x82, 0x42, 0x43, 0x83,
-    0x41, 0x81, 0x80, 0x40};
-
 /* Define the slave ID of the remote device to talk in master mode or set the
  * internal slave ID in slave mode */
-static int _modbus_set_slave(modbus_t *ctx, int slave)
+int _modbus_rtu_set_slave(modbus_t *ctx, int slave)
 {
     int max_slave = (ctx->quirks & MODBUS_QUIRK_MAX_SLAVE) ? 255 : 247;
 
@@ -88,7 +44,7 @@ static int _modbus_set_slave(modbus_t *ctx, int slave)
 }
 
 /* Builds a RTU request header */
-static int _modbus_rtu_build_request_basis(
+int _modbus_rtu_build_request_basis(
     modbus_t *ctx, int function, int addr, int nb, uint8_t *req)
 {
     assert(ctx->slave != -1);
@@ -103,7 +59,7 @@ static int _modbus_rtu_build_request_basis(
 }
 
 /* Builds a RTU response header */
-static int _modbus_rtu_build_response_basis(sft_t *sft, uint8_t *rsp)
+int _modbus_rtu_build_response_basis(sft_t *sft, uint8_t *rsp)
 {
     /* In this case, the slave is certainly valid because a check is already
      * done in _modbus_rtu_listen */
@@ -113,31 +69,15 @@ static int _modbus_rtu_build_response_basis(sft_t *sft, uint8_t *rsp)
     return _MODBUS_RTU_PRESET_RSP_LENGTH;
 }
 
-static uint16_t crc16(uint8_t *buffer, uint16_t buffer_length)
-{
-    uint8_t crc_hi = 0xFF; /* high CRC byte initialized */
-    uint8_t crc_lo = 0xFF; /* low CRC byte initialized */
-    unsigned int i;        /* will index into CRC lookup */
-
-    /* pass through message buffer */
-    while (buffer_length--) {
-        i = crc_lo ^ *buffer++; /* calculate the CRC  */
-        crc_lo = crc_hi ^ table_crc_hi[i];
-        crc_hi = table_crc_lo[i];
-    }
-
-    return (crc_hi << 8 | crc_lo);
-}
-
-static int _modbus_rtu_get_response_tid(const uint8_t *req)
+int _modbus_rtu_get_response_tid(const uint8_t *req)
 {
     /* No TID */
     return 0;
 }
 
-static int _modbus_rtu_send_msg_pre(uint8_t *req, int req_length)
+int _modbus_rtu_send_msg_pre(uint8_t *req, int req_length)
 {
-    uint16_t crc = crc16(req, req_length);
+    uint16_t crc = _modbus_crc16(req, req_length);
 
     /* According to the MODBUS specs (p. 14), the low order byte of the CRC comes
      * first in the RTU message */
@@ -251,6 +191,39 @@ static void _modbus_rtu_ioctl_rts(modbus_t *ctx, int on)
 }
 #endif
 
+#if HAVE_DECL_TIOCM_RTS && !defined(_WIN32)
+/* Waits for the last stop bit of the frame of length bytes written on the line */
+static void wait_tx_end(modbus_t *ctx, int length)
+{
+    modbus_rtu_t *ctx_rtu = ctx->backend_data;
+
+#if HAVE_DECL_TIOCSERGETLSR
+    if (ctx_rtu->tx_wait == MODBUS_RTU_TX_WAIT_LSR) {
+        int lsr;
+
+        /* The frame can't be sent faster, the transmitter is then polled until
+           its shift register is empty (not only the FIFO) */
+        if (length > 1)
+            usleep(ctx_rtu->onebyte_time * (length - 1));
+
+        while (ioctl(ctx->s, TIOCSERGETLSR, &lsr) == 0) {
+            if (lsr & TIOCSER_TEMT)
+                return;
+        }
+        /* Not supported by the driver */
+    }
+#endif
+
+    if (ctx_rtu->tx_wait != MODBUS_RTU_TX_WAIT_DELAY) {
+        while (tcdrain(ctx->s) == -1 && errno == EINTR)
+            ;
+        return;
+    }
+
+    usleep(ctx_rtu->onebyte_time * length + ctx_rtu->rts_delay);
+}
+#endif
+
 static ssize_t _modbus_rtu_send(modbus_t *ctx, const uint8_t *req, int req_length)
 {
 #if defined(_WIN32)
@@ -274,7 +247,8 @@ static ssize_t _modbus_rtu_send(modbus_t *ctx, const uint8_t *req, int req_lengt
 
         size = write(ctx->s, req, req_length);
 
-        usleep(ctx_rtu->onebyte_time * req_length + ctx_rtu->rts_delay);
+        if (size > 0)
+            wait_tx_end(ctx, size);
         ctx_rtu->set_rts(ctx, ctx_rtu->rts != MODBUS_RTU_RTS_UP);
 
         return size;
@@ -319,12 +293,10 @@ static ssize_t _modbus_rtu_recv(modbus_t *ctx, uint8_t *rsp, int rsp_length)
 #endif
 }
 
-static int _modbus_rtu_flush(modbus_t *);
-
-static int _modbus_rtu_pre_check_confirmation(modbus_t *ctx,
-                                              const uint8_t *req,
-                                              const uint8_t *rsp,
-                                              int rsp_length)
+int _modbus_rtu_pre_check_confirmation(modbus_t *ctx,
+                                       const uint8_t *req,
+                                       const uint8_t *rsp,
+                                       int rsp_length)
 {
     /* Check responding slave is the slave we requested (except for broacast
      * request) */
@@ -345,13 +317,17 @@ static int _modbus_rtu_pre_check_confirmation(modbus_t *ctx,
 /* The check_crc16 function shall return 0 if the message is ignored and the
    message length if the CRC is valid. Otherwise it shall return -1 and set
    errno to EMBBADCRC. */
-static int _modbus_rtu_check_integrity(modbus_t *ctx, uint8_t *msg, const int msg_length)
+int _modbus_rtu_check_integrity(modbus_t *ctx, uint8_t *msg, const int msg_length)
 {
     uint16_t crc_calculated;
     uint16_t crc_received;
     int slave = msg[0];
 
-    crc_calculated = crc16(msg, msg_length - 2);
+    /* The CRC is usually computed while the message is received */
+    if (ctx->rx_crc_length == msg_length - 2)
+        crc_calculated = ctx->rx_crc;
+    else
+        crc_calculated = _modbus_crc16(msg, msg_length - 2);
     crc_received = (msg[msg_length - 1] << 8) | msg[msg_length - 2];
 
     /* Check CRC of msg */
@@ -364,7 +340,8 @@ static int _modbus_rtu_check_integrity(modbus_t *ctx, uint8_t *msg, const int ms
         }
 
         if (ctx->error_recovery & MODBUS_ERROR_RECOVERY_PROTOCOL) {
-            _modbus_rtu_flush(ctx);
+            /* Serial port or socket of the RTU over TCP backend */
+            ctx->backend->flush(ctx);
         }
         errno = EMBBADCRC;
         return -1;
@@ -615,6 +592,96 @@ static speed_t _get_termios_speed(int baud, int debug)
     return speed;
 }
 
+/* Sets the low latency flag of the serial driver (no buffering of the received
+   characters by the driver), returns -1 if the driver doesn't keep it */
+static int set_driver_low_latency(modbus_t *ctx, int on)
+{
+#if HAVE_DECL_TIOCGSERIAL && HAVE_DECL_ASYNC_LOW_LATENCY
+    struct serial_struct serial;
+
+    if (ioctl(ctx->s, TIOCGSERIAL, &serial) < 0) {
+        return -1;
+    }
+
+    if (on) {
+        serial.flags |= ASYNC_LOW_LATENCY;
+    } else {
+        serial.flags &= ~ASYNC_LOW_LATENCY;
+    }
+
+    /* Read back, some drivers silently ignore the flag */
+    if (ioctl(ctx->s, TIOCSSERIAL, &serial) < 0 ||
+        ioctl(ctx->s, TIOCGSERIAL, &serial) < 0 ||
+        !(serial.flags & ASYNC_LOW_LATENCY) != !on) {
+        return -1;
+    }
+
+    return 0;
+#else
+    (void) ctx;
+    (void) on;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+/* Sets the minimum number of characters to receive before the port is readable
+   (no timer, VTIME is always 0) */
+static void set_vmin(modbus_t *ctx, int vmin)
+{
+    modbus_rtu_t *ctx_rtu = ctx->backend_data;
+    struct termios tios;
+
+    if (vmin == ctx_rtu->vmin || tcgetattr(ctx->s, &tios) < 0) {
+        return;
+    }
+
+    tios.c_cc[VMIN] = vmin;
+    tios.c_cc[VTIME] = 0;
+    if (tcsetattr(ctx->s, TCSANOW, &tios) == 0) {
+        ctx_rtu->vmin = vmin;
+    }
+}
+
+/* Applies the low latency options requested to the open port */
+static void apply_low_latency(modbus_t *ctx)
+{
+    modbus_rtu_t *ctx_rtu = ctx->backend_data;
+    int driver = ctx_rtu->low_latency & MODBUS_RTU_LOW_LATENCY_DRIVER;
+
+    if (driver != (ctx_rtu->low_latency_applied & MODBUS_RTU_LOW_LATENCY_DRIVER)) {
+        if (driver) {
+#if HAVE_DECL_TIOCGSERIAL && HAVE_DECL_ASYNC_LOW_LATENCY
+            struct serial_struct serial;
+
+            /* Saved to be restored on close */
+            if (ctx_rtu->old_driver_low_latency == -1 &&
+                ioctl(ctx->s, TIOCGSERIAL, &serial) == 0) {
+                ctx_rtu->old_driver_low_latency =
+                    (serial.flags & ASYNC_LOW_LATENCY) ? TRUE : FALSE;
+            }
+#endif
+            if (set_driver_low_latency(ctx, TRUE) == 0) {
+                ctx_rtu->low_latency_applied |= MODBUS_RTU_LOW_LATENCY_DRIVER;
+            } else if (ctx->debug) {
+                fprintf(stderr, "The driver doesn't support the low latency mode\n");
+            }
+        } else {
+            if (ctx_rtu->old_driver_low_latency != TRUE) {
+                set_driver_low_latency(ctx, FALSE);
+            }
+            ctx_rtu->low_latency_applied &= ~MODBUS_RTU_LOW_LATENCY_DRIVER;
+        }
+    }
+
+    if (ctx_rtu->low_latency & MODBUS_RTU_LOW_LATENCY_VMIN) {
+        ctx_rtu->low_latency_applied |= MODBUS_RTU_LOW_LATENCY_VMIN;
+    } else {
+        ctx_rtu->low_latency_applied &= ~MODBUS_RTU_LOW_LATENCY_VMIN;
+        set_vmin(ctx, 0);
+    }
+}
+
 /* POSIX */
 static int _modbus_rtu_connect(modbus_t *ctx)
 {
@@ -848,7 +915,8 @@ static int _modbus_rtu_connect(modbus_t *ctx)
        default), reads will block (wait) indefinitely unless the
        NONBLOCK option is set on the port with open or fcntl.
     */
-    /* Unused because we use open with the NONBLOCK option */
+    /* Unused because we use open with the NONBLOCK option, except by poll
+       when VMIN is set by the low latency mode (see _modbus_rtu_select) */
     tios.c_cc[VMIN] = 0;
     tios.c_cc[VTIME] = 0;
 
@@ -857,6 +925,11 @@ static int _modbus_rtu_connect(modbus_t *ctx)
         ctx->s = -1;
         return -1;
     }
+    ctx_rtu->vmin = 0;
+
+    ctx_rtu->low_latency_applied = MODBUS_RTU_LOW_LATENCY_NONE;
+    ctx_rtu->old_driver_low_latency = -1;
+    apply_low_latency(ctx);
 
     return 0;
 }
@@ -1109,6 +1182,11 @@ static void _modbus_rtu_close(modbus_t *ctx)
     }
 #else
     if (ctx->s >= 0) {
+        if ((ctx_rtu->low_latency_applied & MODBUS_RTU_LOW_LATENCY_DRIVER) &&
+            ctx_rtu->old_driver_low_latency == FALSE) {
+            set_driver_low_latency(ctx, FALSE);
+        }
+        ctx_rtu->low_latency_applied = MODBUS_RTU_LOW_LATENCY_NONE;
         tcsetattr(ctx->s, TCSANOW, &ctx_rtu->old_tios);
         close(ctx->s);
         ctx->s = -1;
@@ -1127,8 +1205,196 @@ static int _modbus_rtu_flush(modbus_t *ctx)
 #endif
 }
 
-static int
-_modbus_rtu_select(modbus_t *ctx, fd_set *rset, struct timeval *tv, int length_to_read)
+/* Sets how the end of the transmission is awaited before to release RTS: by a
+   delay computed from the length of the frame (default), by tcdrain or by
+   polling the transmitter empty bit of the UART */
+int modbus_rtu_set_tx_wait(modbus_t *ctx, int mode)
+{
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (ctx->backend->backend_type == _MODBUS_BACKEND_TYPE_RTU) {
+#if HAVE_DECL_TIOCM_RTS && !defined(_WIN32)
+        modbus_rtu_t *ctx_rtu = ctx->backend_data;
+
+        if (mode == MODBUS_RTU_TX_WAIT_DELAY || mode == MODBUS_RTU_TX_WAIT_DRAIN) {
+            ctx_rtu->tx_wait = mode;
+            return 0;
+        }
+
+        if (mode == MODBUS_RTU_TX_WAIT_LSR) {
+#if HAVE_DECL_TIOCSERGETLSR
+            ctx_rtu->tx_wait = mode;
+            return 0;
+#else
+            if (ctx->debug) {
+                fprintf(stderr, "This mode isn't supported on your platform\n");
+            }
+            errno = ENOTSUP;
+            return -1;
+#endif
+        }
+#else
+        if (ctx->debug) {
+            fprintf(stderr, "This function isn't supported on your platform\n");
+        }
+        errno = ENOTSUP;
+        return -1;
+#endif
+    }
+
+    /* Wrong backend or invalid mode specified */
+    errno = EINVAL;
+    return -1;
+}
+
+int modbus_rtu_get_tx_wait(modbus_t *ctx)
+{
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (ctx->backend->backend_type == _MODBUS_BACKEND_TYPE_RTU) {
+#if HAVE_DECL_TIOCM_RTS && !defined(_WIN32)
+        modbus_rtu_t *ctx_rtu = ctx->backend_data;
+        return ctx_rtu->tx_wait;
+#else
+        if (ctx->debug) {
+            fprintf(stderr, "This function isn't supported on your platform\n");
+        }
+        errno = ENOTSUP;
+        return -1;
+#endif
+    } else {
+        errno = EINVAL;
+        return -1;
+    }
+}
+
+/* Reduces the latency of the reception: low latency mode of the driver and/or
+   wake up only once the expected characters are received (VMIN) */
+int modbus_rtu_set_low_latency(modbus_t *ctx, int options)
+{
+    if (ctx == NULL || ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_RTU ||
+        (options & ~MODBUS_RTU_LOW_LATENCY_ALL) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+#if defined(_WIN32)
+    if (options != MODBUS_RTU_LOW_LATENCY_NONE) {
+        if (ctx->debug) {
+            fprintf(stderr, "This function isn't supported on your platform\n");
+        }
+        errno = ENOTSUP;
+        return -1;
+    }
+#else
+    {
+        modbus_rtu_t *ctx_rtu = ctx->backend_data;
+
+        ctx_rtu->low_latency = options;
+        if (ctx->s >= 0) {
+            apply_low_latency(ctx);
+        }
+    }
+#endif
+
+    return 0;
+}
+
+/* Returns the low latency options applied to the port, the requested ones
+   before the connection */
+int modbus_rtu_get_low_latency(modbus_t *ctx)
+{
+    if (ctx == NULL || ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_RTU) {
+        errno = EINVAL;
+        return -1;
+    }
+
+#if defined(_WIN32)
+    return MODBUS_RTU_LOW_LATENCY_NONE;
+#else
+    {
+        modbus_rtu_t *ctx_rtu = ctx->backend_data;
+
+        if (ctx->s >= 0) {
+            return ctx_rtu->low_latency_applied;
+        }
+        return ctx_rtu->low_latency;
+    }
+#endif
+}
+
+/* Sets the silence used by the receive functions of the context */
+static void update_rx_silence(modbus_t *ctx)
+{
+    modbus_rtu_t *ctx_rtu = ctx->backend_data;
+
+    if (ctx_rtu->framing == MODBUS_RTU_FRAMING_SILENCE) {
+        ctx->rx_silence.tv_sec = ctx_rtu->frame_silence / 1000000;
+        ctx->rx_silence.tv_usec = ctx_rtu->frame_silence % 1000000;
+    } else {
+        ctx->rx_silence.tv_sec = 0;
+        ctx->rx_silence.tv_usec = 0;
+    }
+}
+
+/* Delimits the received frames by their length computed from the function code
+   (default) or by the silence on the bus */
+int modbus_rtu_set_framing(modbus_t *ctx, int framing)
+{
+    if (ctx == NULL || ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_RTU ||
+        (framing != MODBUS_RTU_FRAMING_LENGTH && framing != MODBUS_RTU_FRAMING_SILENCE)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ((modbus_rtu_t *) ctx->backend_data)->framing = framing;
+    update_rx_silence(ctx);
+
+    return 0;
+}
+
+int modbus_rtu_get_framing(modbus_t *ctx)
+{
+    if (ctx == NULL || ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_RTU) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return ((modbus_rtu_t *) ctx->backend_data)->framing;
+}
+
+/* Sets the silence which ends a frame, 3.5 characters by default */
+int modbus_rtu_set_frame_silence(modbus_t *ctx, int us)
+{
+    if (ctx == NULL || ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_RTU ||
+        us <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ((modbus_rtu_t *) ctx->backend_data)->frame_silence = us;
+    update_rx_silence(ctx);
+
+    return 0;
+}
+
+int modbus_rtu_get_frame_silence(modbus_t *ctx)
+{
+    if (ctx == NULL || ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_RTU) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return ((modbus_rtu_t *) ctx->backend_data)->frame_silence;
+}
+
+static int _modbus_rtu_select(modbus_t *ctx, struct timeval *tv, int length_to_read)
 {
     int s_rc;
 #if defined(_WIN32)
@@ -1143,18 +1409,26 @@ _modbus_rtu_select(modbus_t *ctx, fd_set *rset, struct timeval *tv, int length_t
         return -1;
     }
 #else
-    while ((s_rc = select(ctx->s + 1, rset, NULL, NULL, tv)) == -1) {
+    modbus_rtu_t *ctx_rtu = ctx->backend_data;
+
+    if (ctx_rtu->low_latency_applied & MODBUS_RTU_LOW_LATENCY_VMIN) {
+        /* The port is readable once the characters to read are received, every
+           one with the silence framing which doesn't know the frame length */
+        int vmin = length_to_read;
+
+        if (ctx->rx_silence.tv_sec > 0 || ctx->rx_silence.tv_usec > 0 || vmin < 1) {
+            vmin = 1;
+        } else if (vmin > 255) {
+            vmin = 255;
+        }
+        set_vmin(ctx, vmin);
+    }
+
+    while ((s_rc = _modbus_wait(ctx->s, _MODBUS_WAIT_READ, tv)) == -1) {
         if (errno == EINTR) {
             if (ctx->debug) {
                 fprintf(stderr, "A non blocked signal was caught\n");
             }
-            /* Necessary after an error */
-            FD_ZERO(rset);
-            if (ctx->s < 0 || ctx->s >= FD_SETSIZE) {
-                errno = EINVAL;
-                return -1;
-            }
-            FD_SET(ctx->s, rset);
         } else {
             return -1;
         }
@@ -1186,7 +1460,7 @@ const modbus_backend_t _modbus_rtu_backend = {
     _MODBUS_RTU_HEADER_LENGTH,
     _MODBUS_RTU_CHECKSUM_LENGTH,
     MODBUS_RTU_MAX_ADU_LENGTH,
-    _modbus_set_slave,
+    _modbus_rtu_set_slave,
     _modbus_rtu_build_request_basis,
     _modbus_rtu_build_response_basis,
     _modbus_rtu_get_response_tid,
@@ -1266,6 +1540,14 @@ modbus_new_rtu(const char *device, int baud, char parity, int data_bit, int stop
     ctx_rtu->data_bit = data_bit;
     ctx_rtu->stop_bit = stop_bit;
 
+#if !defined(_WIN32)
+    /* Reception driven by the timeouts only */
+    ctx_rtu->low_latency = MODBUS_RTU_LOW_LATENCY_NONE;
+    ctx_rtu->low_latency_applied = MODBUS_RTU_LOW_LATENCY_NONE;
+    ctx_rtu->old_driver_low_latency = -1;
+    ctx_rtu->vmin = 0;
+#endif
+
 #if HAVE_DECL_TIOCSRS485
     /* The RS232 mode has been set by default */
     ctx_rtu->serial_mode = MODBUS_RTU_RS232;
@@ -1284,9 +1566,19 @@ modbus_new_rtu(const char *device, int baud, char parity, int data_bit, int stop
 
     /* The delay before and after transmission when toggling the RTS pin */
     ctx_rtu->rts_delay = ctx_rtu->onebyte_time;
+    ctx_rtu->tx_wait = MODBUS_RTU_TX_WAIT_DELAY;
 #endif
 
     ctx_rtu->confirmation_to_ignore = FALSE;
 
+    /* 3.5 characters, a fixed value is recommended above 19200 bauds */
+    ctx_rtu->framing = MODBUS_RTU_FRAMING_LENGTH;
+    if (baud > 19200) {
+        ctx_rtu->frame_silence = 1750;
+    } else {
+        ctx_rtu->frame_silence =
+            3500000 * (1 + data_bit + (parity == 'N' ? 0 : 1) + stop_bit) / baud;
+    }
+
     return ctx;
 }
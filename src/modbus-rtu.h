@@ -38,6 +38,88 @@ MODBUS_API int modbus_rtu_set_custom_rts(modbus_t *ctx,
 MODBUS_API int modbus_rtu_set_rts_delay(modbus_t *ctx, int us);
 MODBUS_API int modbus_rtu_get_rts_delay(modbus_t *ctx);
 
+#define MODBUS_RTU_TX_WAIT_DELAY 0
+#define MODBUS_RTU_TX_WAIT_DRAIN 1
+#define MODBUS_RTU_TX_WAIT_LSR   2
+
+MODBUS_API int modbus_rtu_set_tx_wait(modbus_t *ctx, int mode);
+MODBUS_API int modbus_rtu_get_tx_wait(modbus_t *ctx);
+
+#define MODBUS_RTU_LOW_LATENCY_NONE   0
+#define MODBUS_RTU_LOW_LATENCY_DRIVER (1 << 0)
+#define MODBUS_RTU_LOW_LATENCY_VMIN   (1 << 1)
+#define MODBUS_RTU_LOW_LATENCY_ALL \
+    (MODBUS_RTU_LOW_LATENCY_DRIVER | MODBUS_RTU_LOW_LATENCY_VMIN)
+
+MODBUS_API int modbus_rtu_set_low_latency(modbus_t *ctx, int options);
+MODBUS_API int modbus_rtu_get_low_latency(modbus_t *ctx);
+
+#define MODBUS_RTU_FRAMING_LENGTH  0
+#define MODBUS_RTU_FRAMING_SILENCE 1
+
+MODBUS_API int modbus_rtu_set_framing(modbus_t *ctx, int framing);
+MODBUS_API int modbus_rtu_get_framing(modbus_t *ctx);
+
+MODBUS_API int modbus_rtu_set_frame_silence(modbus_t *ctx, int us);
+MODBUS_API int modbus_rtu_get_frame_silence(modbus_t *ctx);
+
+/* Scheduler of the transactions with many slaves of a RTU bus */
+typedef struct _modbus_bus modbus_bus_t;
+
+MODBUS_API modbus_bus_t *modbus_bus_new(modbus_t *ctx);
+MODBUS_API int modbus_bus_set_gap(modbus_bus_t *bus, int us);
+MODBUS_API int modbus_bus_set_broadcast_delay(modbus_bus_t *bus, int us);
+MODBUS_API int
+modbus_bus_read_bits(modbus_bus_t *bus, int slave, int addr, int nb, uint8_t *dest);
+MODBUS_API int
+modbus_bus_read_input_bits(modbus_bus_t *bus, int slave, int addr, int nb, uint8_t *dest);
+MODBUS_API int
+modbus_bus_read_registers(modbus_bus_t *bus, int slave, int addr, int nb, uint16_t *dest);
+MODBUS_API int modbus_bus_read_input_registers(
+    modbus_bus_t *bus, int slave, int addr, int nb, uint16_t *dest);
+MODBUS_API int modbus_bus_write_bit(modbus_bus_t *bus, int slave, int addr, int status);
+MODBUS_API int
+modbus_bus_write_register(modbus_bus_t *bus, int slave, int addr, uint16_t value);
+MODBUS_API int modbus_bus_write_bits(
+    modbus_bus_t *bus, int slave, int addr, int nb, const uint8_t *src);
+MODBUS_API int modbus_bus_write_registers(
+    modbus_bus_t *bus, int slave, int addr, int nb, const uint16_t *src);
+MODBUS_API int modbus_bus_complete(modbus_bus_t *bus, int *id);
+MODBUS_API int modbus_bus_get_nb_queued(modbus_bus_t *bus);
+MODBUS_API void modbus_bus_free(modbus_bus_t *bus);
+
+/* Passive monitor of a RTU bus */
+#define MODBUS_RTU_FRAME_REQUEST  0
+#define MODBUS_RTU_FRAME_RESPONSE 1
+#define MODBUS_RTU_FRAME_UNKNOWN  2
+
+typedef struct _modbus_rtu_frame {
+    /* MODBUS_RTU_FRAME_* */
+    int type;
+    int slave;
+    int function;
+    /* Exception code of a response, 0 otherwise */
+    int exception_code;
+    /* Address and number of values of the request, -1 if not applicable */
+    int addr;
+    int nb;
+    int crc_valid;
+    /* Time of the first character in micro seconds since the Epoch */
+    uint64_t timestamp;
+    /* Time between the end of the request and the response in micro seconds,
+       -1 if the frame isn't the response to the previous request */
+    int response_time;
+    const uint8_t *data;
+    int length;
+} modbus_rtu_frame_t;
+
+typedef int (*modbus_rtu_monitor_t)(modbus_t *ctx,
+                                    const modbus_rtu_frame_t *frame,
+                                    void *user_data);
+
+MODBUS_API int
+modbus_rtu_monitor(modbus_t *ctx, modbus_rtu_monitor_t callback, void *user_data);
+
 MODBUS_END_DECLS
 
 #endif /* MODBUS_RTU_H */
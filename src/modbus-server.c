@@ -0,0 +1,935 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ * Modbus TCP server engine, many connections are served by a single thread
+ * with epoll. Many workers (threads), each with its own listening socket
+ * (SO_REUSEPORT), can share the load of a mapping.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _MSC_VER
+#include <unistd.h>
+#endif
+
+#include "modbus-private.h"
+
+#include "modbus-tcp-private.h"
+#include "modbus-tcp.h"
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE1)
+#define HAVE_EPOLL 1
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#endif
+
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_PTHREAD_RWLOCK_INIT)
+#define HAVE_PTHREAD 1
+#include <pthread.h>
+#endif
+
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
+#endif
+
+/* Max number of events handled by epoll_wait call */
+#define _MODBUS_SERVER_MAX_EVENTS 256
+
+/* State of a client connection */
+typedef struct _modbus_server_conn {
+    /* Copy of the server context dedicated to the connection */
+    modbus_t ctx;
+    /* Responses not yet accepted by the socket */
+    uint8_t *tx_buf;
+    int tx_start;
+    int tx_length;
+    int tx_size;
+    struct _modbus_server *server;
+    /* Deferred responses not yet completed, the connection is freed after */
+    int nb_deferred;
+    struct _modbus_server_conn *prev;
+    struct _modbus_server_conn *next;
+} modbus_server_conn_t;
+
+struct _modbus_server {
+    modbus_t *ctx;
+    /* Listening socket */
+    int s;
+    modbus_mapping_t *mb_mapping;
+    int epfd;
+    /* Pipe written by modbus_server_stop */
+    int stop_fds[2];
+    /* Pipe written when deferred responses are completed by other threads */
+    int deferred_fds[2];
+    modbus_deferred_t *deferred_head;
+    modbus_deferred_t *deferred_tail;
+    /* Deferred responses of all the connections not yet completed */
+    int nb_deferred;
+    /* List of the client connections */
+    modbus_server_conn_t *conns;
+    int nb_connections;
+    /* Accepts are suspended when the process runs out of descriptors */
+    int accept_paused;
+    /* The listening socket has been created by the server */
+    int own_socket;
+    /* Additional workers run in their own thread by modbus_server_run */
+    modbus_server_t **workers;
+    int nb_workers;
+#ifdef HAVE_PTHREAD
+    pthread_t thread;
+    /* Serializes the accesses to the mapping shared by the workers */
+    pthread_rwlock_t *lock;
+    pthread_mutex_t deferred_mutex;
+#endif
+};
+
+#ifdef HAVE_EPOLL
+
+static int set_nonblock(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+
+    if (flags == -1)
+        return -1;
+
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static int
+update_events(modbus_server_t *server, int fd, int op, uint32_t events, void *ptr)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = ptr;
+
+    return epoll_ctl(server->epfd, op, fd, &ev);
+}
+
+static void close_conn(modbus_server_t *server, modbus_server_conn_t *conn)
+{
+    if (server->ctx->debug) {
+        printf("Connection closed on socket %d\n", conn->ctx.s);
+    }
+
+    if (conn->prev != NULL)
+        conn->prev->next = conn->next;
+    else
+        server->conns = conn->next;
+    if (conn->next != NULL)
+        conn->next->prev = conn->prev;
+
+    /* The descriptor is removed from the epoll set on close */
+    close(conn->ctx.s);
+    free(conn->tx_buf);
+    server->nb_connections--;
+
+    /* The deferred responses still refer to the connection */
+    if (conn->nb_deferred > 0) {
+        conn->ctx.s = -1;
+        conn->tx_buf = NULL;
+    } else {
+        free(conn);
+    }
+
+    if (server->accept_paused) {
+        server->accept_paused = FALSE;
+        update_events(server, server->s, EPOLL_CTL_MOD, EPOLLIN, &server->s);
+    }
+}
+
+static void accept_conns(modbus_server_t *server)
+{
+    for (;;) {
+        modbus_server_conn_t *conn;
+        int s;
+
+#ifdef HAVE_ACCEPT4
+        s = accept4(server->s, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        s = accept(server->s, NULL, NULL);
+        if (s >= 0 && set_nonblock(s) == -1) {
+            close(s);
+            continue;
+        }
+#endif
+        if (s < 0) {
+            if (errno == EMFILE || errno == ENFILE) {
+                /* Stop to accept until a connection is closed to not spin on
+                   the readable listening socket */
+                if (server->ctx->debug) {
+                    fprintf(stderr,
+                            "ERROR Too many open files (%d connections)\n",
+                            server->nb_connections);
+                }
+                server->accept_paused = TRUE;
+                update_events(server, server->s, EPOLL_CTL_MOD, 0, &server->s);
+            } else if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            /* EAGAIN, no more pending connection */
+            return;
+        }
+
+        conn = (modbus_server_conn_t *) malloc(sizeof(modbus_server_conn_t));
+        if (conn == NULL) {
+            close(s);
+            continue;
+        }
+
+        memcpy(&conn->ctx, server->ctx, sizeof(modbus_t));
+        conn->ctx.s = s;
+        conn->ctx.pending = NULL;
+        conn->ctx.nb_pending = 0;
+        conn->ctx.rx_start = 0;
+        conn->ctx.rx_length = 0;
+        conn->ctx.rx_crc = _MODBUS_CRC16_INIT;
+        conn->ctx.rx_crc_length = 0;
+        conn->ctx.indication_read_ahead = TRUE;
+        conn->ctx.event_driven = TRUE;
+        conn->ctx.server_conn = conn;
+        conn->tx_buf = NULL;
+        conn->tx_start = 0;
+        conn->tx_length = 0;
+        conn->tx_size = 0;
+        conn->server = server;
+        conn->nb_deferred = 0;
+
+        if (update_events(server, s, EPOLL_CTL_ADD, EPOLLIN, conn) == -1) {
+            close(s);
+            free(conn);
+            continue;
+        }
+
+        conn->prev = NULL;
+        conn->next = server->conns;
+        if (server->conns != NULL)
+            server->conns->prev = conn;
+        server->conns = conn;
+        server->nb_connections++;
+        if (server->ctx->debug) {
+            printf("New connection on socket %d (%d connections)\n",
+                   s,
+                   server->nb_connections);
+        }
+    }
+}
+
+/* Sends the response or queues it when the socket isn't writable */
+static int send_rsp(modbus_server_conn_t *conn, uint8_t *rsp, int rsp_length)
+{
+    modbus_t *ctx = &conn->ctx;
+    int rc;
+
+    rsp_length = ctx->backend->send_msg_pre(rsp, rsp_length);
+
+    if (ctx->debug) {
+        int i;
+        for (i = 0; i < rsp_length; i++)
+            printf("[%.2X]", rsp[i]);
+        printf("\n");
+    }
+
+    if (conn->tx_length == 0) {
+        rc = ctx->backend->send(ctx, rsp, rsp_length);
+        if (rc == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return -1;
+            rc = 0;
+        }
+
+        if (rc == rsp_length)
+            return 0;
+
+        rsp += rc;
+        rsp_length -= rc;
+    }
+
+    if (conn->tx_start + conn->tx_length + rsp_length > conn->tx_size) {
+        /* Moves the queued data at the start of the buffer before to grow it */
+        if (conn->tx_length > 0)
+            memmove(conn->tx_buf, conn->tx_buf + conn->tx_start, conn->tx_length);
+        conn->tx_start = 0;
+
+        if (conn->tx_length + rsp_length > conn->tx_size) {
+            int tx_size = conn->tx_size ? conn->tx_size : MODBUS_TCP_MAX_ADU_LENGTH;
+            uint8_t *tx_buf;
+
+            while (tx_size < conn->tx_length + rsp_length)
+                tx_size *= 2;
+
+            tx_buf = (uint8_t *) realloc(conn->tx_buf, tx_size);
+            if (tx_buf == NULL) {
+                errno = ENOMEM;
+                return -1;
+            }
+            conn->tx_buf = tx_buf;
+            conn->tx_size = tx_size;
+        }
+    }
+
+    memcpy(conn->tx_buf + conn->tx_start + conn->tx_length, rsp, rsp_length);
+    conn->tx_length += rsp_length;
+
+    return 0;
+}
+
+/* Writes the queued responses. Returns 0 when the queue is empty. */
+static int flush_tx(modbus_server_conn_t *conn)
+{
+    int rc;
+
+    while (conn->tx_length > 0) {
+        rc = send(conn->ctx.s,
+                  (const char *) conn->tx_buf + conn->tx_start,
+                  conn->tx_length,
+                  MSG_NOSIGNAL);
+        if (rc == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 1;
+            return -1;
+        }
+
+        conn->tx_start += rc;
+        conn->tx_length -= rc;
+    }
+
+    conn->tx_start = 0;
+    return 0;
+}
+
+static int build_reply(modbus_server_t *server,
+                       modbus_t *ctx,
+                       const uint8_t *req,
+                       int req_length,
+                       uint8_t *rsp)
+{
+#ifdef HAVE_PTHREAD
+    if (server->lock != NULL) {
+        int rc;
+
+        if (_modbus_is_write_function(req[ctx->backend->header_length]))
+            pthread_rwlock_wrlock(server->lock);
+        else
+            pthread_rwlock_rdlock(server->lock);
+        rc = _modbus_build_reply(ctx, req, req_length, server->mb_mapping, rsp);
+        pthread_rwlock_unlock(server->lock);
+
+        return rc;
+    }
+#endif
+
+    return _modbus_build_reply(ctx, req, req_length, server->mb_mapping, rsp);
+}
+
+/* Replies to the received requests until the socket has no more data or the
+   responses can't be sent. */
+static int process_conn(modbus_server_t *server, modbus_server_conn_t *conn)
+{
+    modbus_t *ctx = &conn->ctx;
+    uint8_t req[MODBUS_TCP_MAX_ADU_LENGTH];
+    uint8_t rsp[MODBUS_TCP_MAX_ADU_LENGTH];
+    int rc;
+
+    /* The requests are read again once the pending responses are sent */
+    while (conn->tx_length == 0) {
+        rc = _modbus_poll_msg(ctx, req, MSG_INDICATION);
+        if (rc == -1) {
+            if (errno == EAGAIN)
+                return 0;
+            return -1;
+        }
+
+        /* Filtered requests return 0 */
+        if (rc == 0)
+            continue;
+
+        rc = build_reply(server, ctx, req, rc, rsp);
+        if (rc > 0 && send_rsp(conn, rsp, rc) == -1)
+            return -1;
+    }
+
+    /* Waits for the socket to be writable */
+    return update_events(server, ctx->s, EPOLL_CTL_MOD, EPOLLOUT, conn);
+}
+
+/* Sends the deferred responses completed since the last call */
+static void reply_deferred(modbus_server_t *server)
+{
+    modbus_deferred_t *deferred;
+    char c;
+
+    while (read(server->deferred_fds[0], &c, 1) > 0)
+        ;
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&server->deferred_mutex);
+#endif
+    deferred = server->deferred_head;
+    server->deferred_head = NULL;
+    server->deferred_tail = NULL;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&server->deferred_mutex);
+#endif
+
+    while (deferred != NULL) {
+        modbus_deferred_t *next = deferred->next;
+        modbus_server_conn_t *conn = deferred->ctx->server_conn;
+        int tx_length = conn->tx_length;
+
+        conn->nb_deferred--;
+        server->nb_deferred--;
+        if (conn->ctx.s == -1) {
+            /* The connection has been closed meanwhile */
+            if (conn->nb_deferred == 0)
+                free(conn);
+        } else if (send_rsp(conn, deferred->rsp, deferred->rsp_length) == -1 ||
+                   (tx_length == 0 && conn->tx_length > 0 &&
+                    update_events(server, conn->ctx.s, EPOLL_CTL_MOD, EPOLLOUT, conn) ==
+                        -1)) {
+            close_conn(server, conn);
+        }
+
+        free(deferred);
+        deferred = next;
+    }
+}
+
+static int
+handle_conn(modbus_server_t *server, modbus_server_conn_t *conn, uint32_t events)
+{
+    int rc;
+
+    if (events & EPOLLOUT) {
+        rc = flush_tx(conn);
+        if (rc == -1)
+            return -1;
+
+        if (rc == 1) {
+            /* Still waiting */
+            return 0;
+        }
+
+        rc = update_events(server, conn->ctx.s, EPOLL_CTL_MOD, EPOLLIN, conn);
+        if (rc == -1)
+            return -1;
+
+        /* Requests may have been received in advance */
+        return process_conn(server, conn);
+    }
+
+    if (conn->tx_length > 0) {
+        /* Error or hang up while waiting to send the responses */
+        errno = ECONNRESET;
+        return -1;
+    }
+
+    /* Errors and hang up are reported by the read */
+    return process_conn(server, conn);
+}
+
+/* Creates a pipe to wake up the server, its events are identified by fds */
+static int open_pipe(modbus_server_t *server, int fds[2])
+{
+    if (pipe(fds) == -1)
+        return -1;
+
+    if (set_nonblock(fds[0]) == -1 || set_nonblock(fds[1]) == -1)
+        return -1;
+
+    return update_events(server, fds[0], EPOLL_CTL_ADD, EPOLLIN, fds);
+}
+
+static modbus_server_t *server_new(modbus_t *ctx, int s, modbus_mapping_t *mb_mapping)
+{
+    modbus_server_t *server;
+
+    server = (modbus_server_t *) malloc(sizeof(modbus_server_t));
+    if (server == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    server->ctx = ctx;
+    server->s = s;
+    server->mb_mapping = mb_mapping;
+    server->conns = NULL;
+    server->nb_connections = 0;
+    server->accept_paused = FALSE;
+    server->stop_fds[0] = -1;
+    server->stop_fds[1] = -1;
+    server->deferred_fds[0] = -1;
+    server->deferred_fds[1] = -1;
+    server->deferred_head = NULL;
+    server->deferred_tail = NULL;
+    server->nb_deferred = 0;
+    server->own_socket = FALSE;
+    server->workers = NULL;
+    server->nb_workers = 0;
+#ifdef HAVE_PTHREAD
+    server->lock = NULL;
+    if (pthread_mutex_init(&server->deferred_mutex, NULL) != 0) {
+        free(server);
+        errno = ENOMEM;
+        return NULL;
+    }
+#endif
+
+    server->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (server->epfd == -1) {
+#ifdef HAVE_PTHREAD
+        pthread_mutex_destroy(&server->deferred_mutex);
+#endif
+        free(server);
+        return NULL;
+    }
+
+    if (set_nonblock(s) == -1 ||
+        update_events(server, s, EPOLL_CTL_ADD, EPOLLIN, &server->s) == -1 ||
+        open_pipe(server, server->stop_fds) == -1 ||
+        open_pipe(server, server->deferred_fds) == -1) {
+        int saved_errno = errno;
+        modbus_server_free(server);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    return server;
+}
+
+/* Waits for the events of the server until it's stopped */
+static int server_loop(modbus_server_t *server)
+{
+    struct epoll_event events[_MODBUS_SERVER_MAX_EVENTS];
+    int nb_events;
+    int deferred;
+    int i;
+
+    for (;;) {
+        nb_events = epoll_wait(server->epfd, events, _MODBUS_SERVER_MAX_EVENTS, -1);
+        if (nb_events == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        deferred = FALSE;
+        for (i = 0; i < nb_events; i++) {
+            void *ptr = events[i].data.ptr;
+
+            if (ptr == &server->s) {
+                accept_conns(server);
+            } else if (ptr == server->stop_fds) {
+                char c;
+                while (read(server->stop_fds[0], &c, 1) > 0)
+                    ;
+                return 0;
+            } else if (ptr == server->deferred_fds) {
+                deferred = TRUE;
+            } else {
+                modbus_server_conn_t *conn = ptr;
+
+                if (handle_conn(server, conn, events[i].events) == -1) {
+                    if (server->ctx->debug && errno != ECONNRESET) {
+                        fprintf(stderr,
+                                "ERROR Connection %d: %s\n",
+                                conn->ctx.s,
+                                modbus_strerror(errno));
+                    }
+                    close_conn(server, conn);
+                }
+            }
+        }
+
+        /* The connections closed by the deferred responses may be referenced
+           by the other events of the batch, so they are sent after */
+        if (deferred)
+            reply_deferred(server);
+    }
+}
+
+#ifdef HAVE_PTHREAD
+static void *worker_run(void *arg)
+{
+    server_loop((modbus_server_t *) arg);
+    return NULL;
+}
+#endif
+
+static int check_server_ctx(modbus_t *ctx)
+{
+    if (ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_TCP) {
+        if (ctx->debug) {
+            fprintf(stderr, "The server engine is only available with TCP contexts\n");
+        }
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+#endif /* HAVE_EPOLL */
+
+/* Allocates a server to reply to the requests of many clients on the listening
+   socket s (see modbus_tcp_listen and modbus_tcp_pi_listen) with the data of
+   mb_mapping. The context is used as template for the connections. */
+modbus_server_t *modbus_server_new(modbus_t *ctx, int s, modbus_mapping_t *mb_mapping)
+{
+#ifdef HAVE_EPOLL
+    if (ctx == NULL || s < 0 || mb_mapping == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (check_server_ctx(ctx) == -1)
+        return NULL;
+
+    return server_new(ctx, s, mb_mapping);
+#else
+    (void) s;
+    (void) mb_mapping;
+    if (ctx != NULL && ctx->debug) {
+        fprintf(stderr, "This function isn't supported on your platform\n");
+    }
+    errno = ENOTSUP;
+    return NULL;
+#endif
+}
+
+/* Allocates a server of nb_workers workers listening on the address of the
+   context. Each worker owns a listening socket bound with SO_REUSEPORT so the
+   kernel spreads the connections between them, and runs in its own thread.
+   The accesses to the shared mapping are serialized by a read-write lock. */
+modbus_server_t *modbus_server_new_workers(modbus_t *ctx,
+                                           int nb_connection,
+                                           int nb_workers,
+                                           modbus_mapping_t *mb_mapping)
+{
+#ifdef HAVE_EPOLL
+    modbus_server_t *server;
+    int s;
+    int i;
+
+    if (ctx == NULL || nb_workers < 1 || mb_mapping == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (check_server_ctx(ctx) == -1)
+        return NULL;
+
+#ifndef HAVE_PTHREAD
+    if (nb_workers > 1) {
+        if (ctx->debug) {
+            fprintf(stderr, "Many workers aren't supported on your platform\n");
+        }
+        errno = ENOTSUP;
+        return NULL;
+    }
+#endif
+
+    s = _modbus_tcp_listen_shared(ctx, nb_connection);
+    if (s == -1)
+        return NULL;
+
+    server = server_new(ctx, s, mb_mapping);
+    if (server == NULL) {
+        int saved_errno = errno;
+        close(s);
+        errno = saved_errno;
+        return NULL;
+    }
+    server->own_socket = TRUE;
+
+    if (nb_workers == 1)
+        return server;
+
+#ifdef HAVE_PTHREAD
+    server->workers =
+        (modbus_server_t **) calloc(nb_workers - 1, sizeof(modbus_server_t *));
+    if (server->workers == NULL) {
+        modbus_server_free(server);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    /* A synchronized mapping is protected by its own sequence lock */
+    if (!(mb_mapping->flags & MODBUS_MAPPING_SYNC)) {
+        server->lock = (pthread_rwlock_t *) malloc(sizeof(pthread_rwlock_t));
+        if (server->lock == NULL || pthread_rwlock_init(server->lock, NULL) != 0) {
+            free(server->lock);
+            server->lock = NULL;
+            modbus_server_free(server);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    for (i = 0; i < nb_workers - 1; i++) {
+        modbus_server_t *worker;
+
+        s = _modbus_tcp_listen_shared(ctx, nb_connection);
+        if (s == -1) {
+            worker = NULL;
+        } else {
+            worker = server_new(ctx, s, mb_mapping);
+            if (worker == NULL)
+                close(s);
+        }
+
+        if (worker == NULL) {
+            int saved_errno = errno;
+            modbus_server_free(server);
+            errno = saved_errno;
+            return NULL;
+        }
+
+        worker->own_socket = TRUE;
+        worker->lock = server->lock;
+        server->workers[i] = worker;
+        server->nb_workers++;
+    }
+
+    return server;
+#else
+    (void) i;
+    return server;
+#endif
+#else
+    (void) nb_connection;
+    (void) nb_workers;
+    (void) mb_mapping;
+    if (ctx != NULL && ctx->debug) {
+        fprintf(stderr, "This function isn't supported on your platform\n");
+    }
+    errno = ENOTSUP;
+    return NULL;
+#endif
+}
+
+/* Accepts the connections and replies to the requests until modbus_server_stop
+   is called. */
+int modbus_server_run(modbus_server_t *server)
+{
+#ifdef HAVE_EPOLL
+    int rc;
+    int i;
+
+    if (server == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+#ifdef HAVE_PTHREAD
+    for (i = 0; i < server->nb_workers; i++) {
+        rc = pthread_create(
+            &server->workers[i]->thread, NULL, worker_run, server->workers[i]);
+        if (rc != 0) {
+            /* Stops the workers already started */
+            while (--i >= 0) {
+                modbus_server_stop(server->workers[i]);
+                pthread_join(server->workers[i]->thread, NULL);
+            }
+            errno = rc;
+            return -1;
+        }
+    }
+#endif
+
+    rc = server_loop(server);
+
+#ifdef HAVE_PTHREAD
+    if (server->nb_workers > 0) {
+        int saved_errno = errno;
+
+        /* The workers are already stopped unless the loop has failed */
+        for (i = 0; i < server->nb_workers; i++) {
+            if (rc == -1)
+                modbus_server_stop(server->workers[i]);
+            pthread_join(server->workers[i]->thread, NULL);
+        }
+        errno = saved_errno;
+    }
+#else
+    (void) i;
+#endif
+
+    return rc;
+#else
+    (void) server;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+/* Stops modbus_server_run, the function can be called from another thread or
+   a signal handler. */
+int modbus_server_stop(modbus_server_t *server)
+{
+#ifdef HAVE_EPOLL
+    char c = 0;
+    int i;
+
+    if (server == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (i = 0; i < server->nb_workers; i++) {
+        if (modbus_server_stop(server->workers[i]) == -1)
+            return -1;
+    }
+
+    if (write(server->stop_fds[1], &c, 1) == -1 && errno != EAGAIN)
+        return -1;
+
+    return 0;
+#else
+    (void) server;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+/* Returns the number of client connections of all the workers */
+int modbus_server_get_nb_connections(modbus_server_t *server)
+{
+    int nb_connections;
+    int i;
+
+    if (server == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    nb_connections = server->nb_connections;
+    for (i = 0; i < server->nb_workers; i++)
+        nb_connections += server->workers[i]->nb_connections;
+
+    return nb_connections;
+}
+
+/* Closes the client connections and frees the server. The listening socket
+   (unless created by modbus_server_new_workers), the context and the mapping
+   are not freed. The function waits for the deferred responses not yet
+   completed, they can't be completed after. */
+void modbus_server_free(modbus_server_t *server)
+{
+#ifdef HAVE_EPOLL
+    int i;
+
+    if (server == NULL)
+        return;
+
+#ifdef HAVE_PTHREAD
+    /* The lock is owned by the server of the workers */
+    if (server->workers != NULL && server->lock != NULL) {
+        pthread_rwlock_destroy(server->lock);
+        free(server->lock);
+    }
+#endif
+
+    for (i = 0; i < server->nb_workers; i++)
+        modbus_server_free(server->workers[i]);
+    free(server->workers);
+
+    server->accept_paused = FALSE;
+    while (server->conns != NULL)
+        close_conn(server, server->conns);
+
+    /* Waits for the deferred responses still referring to the server, the
+       connections are freed with their last one */
+    while (server->nb_deferred > 0) {
+        struct pollfd pfd;
+
+        pfd.fd = server->deferred_fds[0];
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+            break;
+        reply_deferred(server);
+    }
+
+    if (server->epfd != -1) {
+        epoll_ctl(server->epfd, EPOLL_CTL_DEL, server->s, NULL);
+        close(server->epfd);
+    }
+
+    if (server->stop_fds[0] != -1) {
+        close(server->stop_fds[0]);
+        close(server->stop_fds[1]);
+    }
+
+    if (server->deferred_fds[0] != -1) {
+        close(server->deferred_fds[0]);
+        close(server->deferred_fds[1]);
+    }
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_destroy(&server->deferred_mutex);
+#endif
+
+    if (server->own_socket)
+        close(server->s);
+
+    free(server);
+#else
+    (void) server;
+#endif
+}
+
+/* Counts the response deferred by a handler of the connection */
+void _modbus_server_defer(modbus_deferred_t *deferred)
+{
+#ifdef HAVE_EPOLL
+    modbus_server_conn_t *conn = deferred->ctx->server_conn;
+
+    conn->nb_deferred++;
+    conn->server->nb_deferred++;
+#else
+    (void) deferred;
+#endif
+}
+
+/* Queues the completed response to the thread of the connection, the function
+   can be called from any thread. */
+int _modbus_server_complete(modbus_deferred_t *deferred)
+{
+#ifdef HAVE_EPOLL
+    modbus_server_conn_t *conn = deferred->ctx->server_conn;
+    modbus_server_t *server = conn->server;
+    int wake_up;
+    char c = 0;
+
+    deferred->next = NULL;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&server->deferred_mutex);
+#endif
+    /* A single wake up for the responses queued before the server reads them */
+    wake_up = server->deferred_head == NULL;
+    if (server->deferred_tail != NULL)
+        server->deferred_tail->next = deferred;
+    else
+        server->deferred_head = deferred;
+    server->deferred_tail = deferred;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&server->deferred_mutex);
+#endif
+
+    if (wake_up && write(server->deferred_fds[1], &c, 1) == -1 && errno != EAGAIN)
+        return -1;
+
+    return 0;
+#else
+    (void) deferred;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
@@ -0,0 +1,336 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ * Mappings in POSIX shared memory, the tables are shared by the processes
+ * attached to the same region (servers, data producers).
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "modbus-private.h"
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_SHM_OPEN) && defined(_MODBUS_HAVE_ATOMICS)
+#define HAVE_SHM 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SHM
+
+/* The tables are aligned on a cache line in the region */
+#define _MODBUS_SHM_ALIGN(size) (((size) + 63) & ~((size_t) 63))
+
+/* Max wait of the initialization of a region created by another process */
+#define _MODBUS_SHM_INIT_TIMEOUT_MS 1000
+
+/* Options accepted in a shared mapping */
+#define _MODBUS_SHM_FLAGS \
+    ((unsigned int) (MODBUS_MAPPING_SYNC | MODBUS_MAPPING_PACKED_BITS | \
+                     MODBUS_MAPPING_WIRE_ORDER))
+
+static size_t table_size(int table, int nb, unsigned int flags)
+{
+    if (table == MODBUS_TABLE_BITS || table == MODBUS_TABLE_INPUT_BITS) {
+        if (flags & MODBUS_MAPPING_PACKED_BITS)
+            return (nb / 8) + ((nb % 8) ? 1 : 0);
+        return nb;
+    }
+
+    return nb * sizeof(uint16_t);
+}
+
+/* Checks the layout written by another process, the tables must be inside the
+   region */
+static int check_header(const modbus_mapping_shm_header_t *header)
+{
+    int table;
+
+    if (header->version != _MODBUS_SHM_VERSION || (header->flags & ~_MODBUS_SHM_FLAGS))
+        return -1;
+
+    for (table = MODBUS_TABLE_BITS; table <= MODBUS_TABLE_INPUT_REGISTERS; table++) {
+        if (header->nb[table] > UINT16_MAX + 1)
+            return -1;
+        if (header->offset[table] < sizeof(modbus_mapping_shm_header_t) ||
+            header->offset[table] > header->size ||
+            table_size(table, header->nb[table], header->flags) >
+                header->size - header->offset[table])
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Maps the region of fd once initialized by its creator */
+static modbus_mapping_shm_header_t *map_region(int fd)
+{
+    struct timespec delay = {0, 1000000};
+    int i;
+
+    for (i = 0; i < _MODBUS_SHM_INIT_TIMEOUT_MS; i++) {
+        modbus_mapping_shm_header_t *header;
+        struct stat st;
+
+        if (fstat(fd, &st) == -1)
+            return NULL;
+
+        if (st.st_size >= (off_t) sizeof(modbus_mapping_shm_header_t)) {
+            header = (modbus_mapping_shm_header_t *) mmap(
+                NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (header == MAP_FAILED)
+                return NULL;
+
+            /* The magic number is written last by the creator */
+            if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) ==
+                _MODBUS_SHM_MAGIC) {
+                if (header->size != (uint32_t) st.st_size || check_header(header) == -1) {
+                    munmap(header, st.st_size);
+                    errno = EINVAL;
+                    return NULL;
+                }
+                return header;
+            }
+            munmap(header, st.st_size);
+        }
+
+        nanosleep(&delay, NULL);
+    }
+
+    errno = ETIMEDOUT;
+    return NULL;
+}
+
+/* Builds a mapping whose tables point into the region */
+static modbus_mapping_t *new_mapping(modbus_mapping_shm_header_t *header)
+{
+    modbus_mapping_t *mb_mapping;
+    modbus_mapping_ext_t *ext;
+    uint8_t *base = (uint8_t *) header;
+
+    mb_mapping = (modbus_mapping_t *) malloc(sizeof(modbus_mapping_t));
+    if (mb_mapping == NULL) {
+        munmap(header, header->size);
+        return NULL;
+    }
+
+    ext = (modbus_mapping_ext_t *) calloc(1, sizeof(modbus_mapping_ext_t));
+    if (ext == NULL) {
+        munmap(header, header->size);
+        free(mb_mapping);
+        return NULL;
+    }
+    ext->shm = header;
+    ext->shm_size = header->size;
+
+    mb_mapping->flags = header->flags | MODBUS_MAPPING_SHARED;
+    mb_mapping->ext = ext;
+
+    mb_mapping->start_bits = header->start[MODBUS_TABLE_BITS];
+    mb_mapping->nb_bits = header->nb[MODBUS_TABLE_BITS];
+    mb_mapping->tab_bits =
+        header->nb[MODBUS_TABLE_BITS] ? base + header->offset[MODBUS_TABLE_BITS] : NULL;
+
+    mb_mapping->start_input_bits = header->start[MODBUS_TABLE_INPUT_BITS];
+    mb_mapping->nb_input_bits = header->nb[MODBUS_TABLE_INPUT_BITS];
+    mb_mapping->tab_input_bits = header->nb[MODBUS_TABLE_INPUT_BITS]
+                                     ? base + header->offset[MODBUS_TABLE_INPUT_BITS]
+                                     : NULL;
+
+    mb_mapping->start_registers = header->start[MODBUS_TABLE_REGISTERS];
+    mb_mapping->nb_registers = header->nb[MODBUS_TABLE_REGISTERS];
+    mb_mapping->tab_registers =
+        header->nb[MODBUS_TABLE_REGISTERS]
+            ? (uint16_t *) (base + header->offset[MODBUS_TABLE_REGISTERS])
+            : NULL;
+
+    mb_mapping->start_input_registers = header->start[MODBUS_TABLE_INPUT_REGISTERS];
+    mb_mapping->nb_input_registers = header->nb[MODBUS_TABLE_INPUT_REGISTERS];
+    mb_mapping->tab_input_registers =
+        header->nb[MODBUS_TABLE_INPUT_REGISTERS]
+            ? (uint16_t *) (base + header->offset[MODBUS_TABLE_INPUT_REGISTERS])
+            : NULL;
+
+    return mb_mapping;
+}
+
+#endif
+
+/* Creates the mapping in the shared memory object name, or attaches to it if
+   it already exists with the same layout. */
+modbus_mapping_t *modbus_mapping_new_shm(const char *name,
+                                         unsigned int start_bits,
+                                         unsigned int nb_bits,
+                                         unsigned int start_input_bits,
+                                         unsigned int nb_input_bits,
+                                         unsigned int start_registers,
+                                         unsigned int nb_registers,
+                                         unsigned int start_input_registers,
+                                         unsigned int nb_input_registers,
+                                         unsigned int flags)
+{
+#ifdef HAVE_SHM
+    modbus_mapping_shm_header_t *header;
+    unsigned int start[4];
+    unsigned int nb[4];
+    size_t size;
+    int table;
+    int fd;
+
+    if (name == NULL || (flags & ~_MODBUS_SHM_FLAGS)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    start[MODBUS_TABLE_BITS] = start_bits;
+    nb[MODBUS_TABLE_BITS] = nb_bits;
+    start[MODBUS_TABLE_INPUT_BITS] = start_input_bits;
+    nb[MODBUS_TABLE_INPUT_BITS] = nb_input_bits;
+    start[MODBUS_TABLE_REGISTERS] = start_registers;
+    nb[MODBUS_TABLE_REGISTERS] = nb_registers;
+    start[MODBUS_TABLE_INPUT_REGISTERS] = start_input_registers;
+    nb[MODBUS_TABLE_INPUT_REGISTERS] = nb_input_registers;
+
+    size = _MODBUS_SHM_ALIGN(sizeof(modbus_mapping_shm_header_t));
+    for (table = MODBUS_TABLE_BITS; table <= MODBUS_TABLE_INPUT_REGISTERS; table++) {
+        if (nb[table] > UINT16_MAX + 1) {
+            errno = EINVAL;
+            return NULL;
+        }
+        size += _MODBUS_SHM_ALIGN(table_size(table, nb[table], flags));
+    }
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0660);
+    if (fd != -1) {
+        /* New region, filled with zeros */
+        if (ftruncate(fd, size) == -1) {
+            close(fd);
+            shm_unlink(name);
+            return NULL;
+        }
+
+        header = (modbus_mapping_shm_header_t *) mmap(
+            NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (header == MAP_FAILED) {
+            shm_unlink(name);
+            return NULL;
+        }
+
+        header->version = _MODBUS_SHM_VERSION;
+        header->size = size;
+        header->flags = flags;
+        size = _MODBUS_SHM_ALIGN(sizeof(modbus_mapping_shm_header_t));
+        for (table = MODBUS_TABLE_BITS; table <= MODBUS_TABLE_INPUT_REGISTERS; table++) {
+            header->start[table] = start[table];
+            header->nb[table] = nb[table];
+            header->offset[table] = size;
+            size += _MODBUS_SHM_ALIGN(table_size(table, nb[table], flags));
+        }
+        /* The region can be used by the other processes */
+        __atomic_store_n(&header->magic, _MODBUS_SHM_MAGIC, __ATOMIC_RELEASE);
+    } else {
+        if (errno != EEXIST)
+            return NULL;
+
+        fd = shm_open(name, O_RDWR, 0);
+        if (fd == -1)
+            return NULL;
+
+        header = map_region(fd);
+        close(fd);
+        if (header == NULL)
+            return NULL;
+
+        for (table = MODBUS_TABLE_BITS; table <= MODBUS_TABLE_INPUT_REGISTERS; table++) {
+            if (header->start[table] != start[table] || header->nb[table] != nb[table])
+                break;
+        }
+        if (table <= MODBUS_TABLE_INPUT_REGISTERS || header->flags != flags) {
+            /* Another layout */
+            munmap(header, header->size);
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+
+    return new_mapping(header);
+#else
+    (void) name;
+    (void) start_bits;
+    (void) nb_bits;
+    (void) start_input_bits;
+    (void) nb_input_bits;
+    (void) start_registers;
+    (void) nb_registers;
+    (void) start_input_registers;
+    (void) nb_input_registers;
+    (void) flags;
+    errno = ENOTSUP;
+    return NULL;
+#endif
+}
+
+/* Attaches to the mapping of the shared memory object name, the layout and the
+   options are read from the region. */
+modbus_mapping_t *modbus_mapping_attach_shm(const char *name)
+{
+#ifdef HAVE_SHM
+    modbus_mapping_shm_header_t *header;
+    int fd;
+
+    if (name == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd == -1)
+        return NULL;
+
+    header = map_region(fd);
+    close(fd);
+    if (header == NULL)
+        return NULL;
+
+    return new_mapping(header);
+#else
+    (void) name;
+    errno = ENOTSUP;
+    return NULL;
+#endif
+}
+
+/* Removes the shared memory object name, the region is released once all the
+   processes have freed their mappings. */
+int modbus_mapping_unlink_shm(const char *name)
+{
+#ifdef HAVE_SHM
+    if (name == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return shm_unlink(name);
+#else
+    (void) name;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+/* Unmaps the region of a shared mapping */
+void _modbus_mapping_unmap_shm(modbus_mapping_ext_t *ext)
+{
+#ifdef HAVE_SHM
+    munmap(ext->shm, ext->shm_size);
+#else
+    (void) ext;
+#endif
+}
@@ -25,6 +25,8 @@ typedef struct _modbus_tcp {
     int port;
     /* IP address */
     char ip[16];
+    /* RTU over TCP: the response to a request for another slave is ignored */
+    int confirmation_to_ignore;
 } modbus_tcp_t;
 
 typedef struct _modbus_tcp_pi {
@@ -38,4 +40,6 @@ typedef struct _modbus_tcp_pi {
     char *service;
 } modbus_tcp_pi_t;
 
+int _modbus_tcp_listen_shared(modbus_t *ctx, int nb_connection);
+
 #endif /* MODBUS_TCP_PRIVATE_H */
@@ -64,9 +64,12 @@
 
 #include "modbus-private.h"
 
+#include "modbus-rtu-private.h"
 #include "modbus-tcp-private.h"
 #include "modbus-tcp.h"
 
+extern const modbus_backend_t _modbus_tcp_pi_backend;
+
 #ifdef OS_WIN32
 static int _modbus_tcp_init_win32(void)
 {
@@ -187,6 +190,31 @@ static int _modbus_tcp_receive(modbus_t *ctx, uint8_t *req)
     return _modbus_receive_msg(ctx, req, MSG_INDICATION);
 }
 
+/* The stream carries the frames of a shared serial bus so, as in
+   _modbus_rtu_receive, the response to a request for another slave is skipped */
+static int _modbus_rtu_tcp_receive(modbus_t *ctx, uint8_t *req)
+{
+    int rc;
+    modbus_tcp_t *ctx_tcp = ctx->backend_data;
+
+    if (ctx_tcp->confirmation_to_ignore) {
+        (void) _modbus_receive_msg(ctx, req, MSG_CONFIRMATION);
+        /* Ignore errors and reset the flag */
+        ctx_tcp->confirmation_to_ignore = FALSE;
+        rc = 0;
+        if (ctx->debug) {
+            printf("Confirmation to ignore\n");
+        }
+    } else {
+        rc = _modbus_receive_msg(ctx, req, MSG_INDICATION);
+        if (rc == 0) {
+            /* The next expected message is a confirmation to ignore */
+            ctx_tcp->confirmation_to_ignore = TRUE;
+        }
+    }
+    return rc;
+}
+
 static ssize_t _modbus_tcp_recv(modbus_t *ctx, uint8_t *rsp, int rsp_length)
 {
     return recv(ctx->s, (char *) rsp, rsp_length, 0);
@@ -298,19 +326,14 @@ static int _connect(int sockfd,
 #else
     if (rc == -1 && errno == EINPROGRESS) {
 #endif
-        fd_set wset;
         int optval;
         socklen_t optlen = sizeof(optval);
         struct timeval tv = *ro_tv;
 
         /* Wait to be available in writing */
-        FD_ZERO(&wset);
-        if (sockfd >= FD_SETSIZE) {
-            errno = EINVAL;
-            return -1;
-        }
-        FD_SET(sockfd, &wset);
-        rc = select(sockfd + 1, NULL, &wset, NULL, &tv);
+        while ((rc = _modbus_wait(sockfd, _MODBUS_WAIT_WRITE, &tv)) == -1 &&
+               errno == EINTR)
+            ;
         if (rc < 0) {
             /* Fail */
             return -1;
@@ -362,20 +385,6 @@ static int _modbus_tcp_connect(modbus_t *ctx)
         return -1;
     }
 
-    if (ctx->s >= FD_SETSIZE) {
-        if (ctx->debug) {
-            fprintf(
-                stderr,
-                "ERROR Socket descriptor %d exceeds FD_SETSIZE (%d)\n",
-                ctx->s,
-                FD_SETSIZE);
-        }
-        close(ctx->s);
-        ctx->s = -1;
-        errno = EINVAL;
-        return -1;
-    }
-
     rc = _modbus_tcp_set_ipv4_options(ctx->s);
     if (rc == -1) {
         close(ctx->s);
@@ -466,18 +475,6 @@ static int _modbus_tcp_pi_connect(modbus_t *ctx)
         if (s < 0)
             continue;
 
-        if (s >= FD_SETSIZE) {
-            if (ctx->debug) {
-                fprintf(
-                    stderr,
-                    "ERROR Socket descriptor %d exceeds FD_SETSIZE (%d)\n",
-                    s,
-                    FD_SETSIZE);
-            }
-            close(s);
-            continue;
-        }
-
         if (ai_ptr->ai_family == AF_INET)
             _modbus_tcp_set_ipv4_options(s);
 
@@ -533,18 +530,11 @@ static int _modbus_tcp_flush(modbus_t *ctx)
         rc = recv(ctx->s, devnull, MODBUS_TCP_MAX_ADU_LENGTH, MSG_DONTWAIT);
 #else
         /* On Win32, it's a bit more complicated to not wait */
-        fd_set rset;
         struct timeval tv;
 
         tv.tv_sec = 0;
         tv.tv_usec = 0;
-        FD_ZERO(&rset);
-        if (ctx->s < 0 || ctx->s >= FD_SETSIZE) {
-            errno = EINVAL;
-            return -1;
-        }
-        FD_SET(ctx->s, &rset);
-        rc = select(ctx->s + 1, &rset, NULL, NULL, &tv);
+        rc = _modbus_wait(ctx->s, _MODBUS_WAIT_READ, &tv);
         if (rc == -1) {
             return -1;
         }
@@ -571,11 +561,45 @@ static int _modbus_tcp_flush(modbus_t *ctx)
     return (int) rc_sum;
 }
 
+/* Allows to bind the address again, and with reuse_port, to share it between
+   many listening sockets (the kernel balances the connections). */
+static int _modbus_tcp_set_reuse(modbus_t *ctx, int s, int reuse_port)
+{
+    int enable = 1;
+    int rc;
+
+#ifdef _WIN32
+    rc = setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *) &enable, sizeof(enable));
+#else
+    rc = setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const void *) &enable, sizeof(enable));
+#endif
+    if (rc == -1) {
+        return -1;
+    }
+
+    if (reuse_port) {
+#ifdef SO_REUSEPORT
+        rc = setsockopt(
+            s, SOL_SOCKET, SO_REUSEPORT, (const void *) &enable, sizeof(enable));
+        if (rc == -1) {
+            return -1;
+        }
+#else
+        if (ctx->debug) {
+            fprintf(stderr, "SO_REUSEPORT isn't supported on your platform\n");
+        }
+        errno = ENOTSUP;
+        return -1;
+#endif
+    }
+
+    return 0;
+}
+
 /* Listens for any request from one or many modbus masters in TCP */
-int modbus_tcp_listen(modbus_t *ctx, int nb_connection)
+static int _modbus_tcp_listen(modbus_t *ctx, int nb_connection, int reuse_port)
 {
     int new_s;
-    int enable;
     int flags;
     struct sockaddr_in addr;
     modbus_tcp_t *ctx_tcp;
@@ -605,13 +629,10 @@ int modbus_tcp_listen(modbus_t *ctx, int nb_connection)
         return -1;
     }
 
-    enable = 1;
-#ifdef _WIN32
-    if (setsockopt(new_s, SOL_SOCKET, SO_REUSEADDR, (const char *)&enable, sizeof(enable)) == -1) {
-#else
-    if (setsockopt(new_s, SOL_SOCKET, SO_REUSEADDR, (const void *)&enable, sizeof(enable)) == -1) {
-#endif
+    if (_modbus_tcp_set_reuse(ctx, new_s, reuse_port) == -1) {
+        int saved_errno = errno;
         close(new_s);
+        errno = saved_errno;
         return -1;
     }
 
@@ -647,7 +668,12 @@ int modbus_tcp_listen(modbus_t *ctx, int nb_connection)
     return new_s;
 }
 
-int modbus_tcp_pi_listen(modbus_t *ctx, int nb_connection)
+int modbus_tcp_listen(modbus_t *ctx, int nb_connection)
+{
+    return _modbus_tcp_listen(ctx, nb_connection, FALSE);
+}
+
+static int _modbus_tcp_pi_listen(modbus_t *ctx, int nb_connection, int reuse_port)
 {
     int rc;
     struct addrinfo *ai_list;
@@ -728,12 +754,7 @@ int modbus_tcp_pi_listen(modbus_t *ctx, int nb_connection)
             }
             continue;
         } else {
-            int enable = 1;
-#ifdef _WIN32
-            rc = setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *)&enable, sizeof(enable));
-#else
-            rc = setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const void *)&enable, sizeof(enable));
-#endif
+            rc = _modbus_tcp_set_reuse(ctx, s, reuse_port);
             if (rc != 0) {
                 close(s);
                 if (ctx->debug) {
@@ -773,6 +794,21 @@ int modbus_tcp_pi_listen(modbus_t *ctx, int nb_connection)
     return new_s;
 }
 
+int modbus_tcp_pi_listen(modbus_t *ctx, int nb_connection)
+{
+    return _modbus_tcp_pi_listen(ctx, nb_connection, FALSE);
+}
+
+/* Creates a listening socket which shares the address of the context with
+   the other listening sockets created by this function (SO_REUSEPORT). */
+int _modbus_tcp_listen_shared(modbus_t *ctx, int nb_connection)
+{
+    if (ctx->backend == &_modbus_tcp_pi_backend)
+        return _modbus_tcp_pi_listen(ctx, nb_connection, TRUE);
+
+    return _modbus_tcp_listen(ctx, nb_connection, TRUE);
+}
+
 int modbus_tcp_accept(modbus_t *ctx, int *s)
 {
     struct sockaddr_in addr;
@@ -795,20 +831,6 @@ int modbus_tcp_accept(modbus_t *ctx, int *s)
         return -1;
     }
 
-    if (ctx->s >= FD_SETSIZE) {
-        if (ctx->debug) {
-            fprintf(
-                stderr,
-                "ERROR Socket descriptor %d exceeds FD_SETSIZE (%d)\n",
-                ctx->s,
-                FD_SETSIZE);
-        }
-        close(ctx->s);
-        ctx->s = -1;
-        errno = EINVAL;
-        return -1;
-    }
-
     if (ctx->debug) {
         char buf[INET_ADDRSTRLEN];
         if (inet_ntop(AF_INET, &(addr.sin_addr), buf, INET_ADDRSTRLEN) == NULL) {
@@ -843,20 +865,6 @@ int modbus_tcp_pi_accept(modbus_t *ctx, int *s)
         return -1;
     }
 
-    if (ctx->s >= FD_SETSIZE) {
-        if (ctx->debug) {
-            fprintf(
-                stderr,
-                "ERROR Socket descriptor %d exceeds FD_SETSIZE (%d)\n",
-                ctx->s,
-                FD_SETSIZE);
-        }
-        close(ctx->s);
-        ctx->s = -1;
-        errno = EINVAL;
-        return -1;
-    }
-
     if (ctx->debug) {
         char buf[INET6_ADDRSTRLEN];
         if (inet_ntop(AF_INET6, &(addr.sin6_addr), buf, INET6_ADDRSTRLEN) == NULL) {
@@ -869,22 +877,14 @@ int modbus_tcp_pi_accept(modbus_t *ctx, int *s)
     return ctx->s;
 }
 
-static int
-_modbus_tcp_select(modbus_t *ctx, fd_set *rset, struct timeval *tv, int length_to_read)
+static int _modbus_tcp_select(modbus_t *ctx, struct timeval *tv, int length_to_read)
 {
     int s_rc;
-    while ((s_rc = select(ctx->s + 1, rset, NULL, NULL, tv)) == -1) {
+    while ((s_rc = _modbus_wait(ctx->s, _MODBUS_WAIT_READ, tv)) == -1) {
         if (errno == EINTR) {
             if (ctx->debug) {
                 fprintf(stderr, "A non blocked signal was caught\n");
             }
-            /* Necessary after an error */
-            FD_ZERO(rset);
-            if (ctx->s < 0 || ctx->s >= FD_SETSIZE) {
-                errno = EINVAL;
-                return -1;
-            }
-            FD_SET(ctx->s, rset);
         } else {
             return -1;
         }
@@ -965,9 +965,34 @@ const modbus_backend_t _modbus_tcp_pi_backend = {
     _modbus_tcp_pi_free
 };
 
+/* RTU frames with their CRC, as sent on the serial line, over the TCP
+   connection of a serial device server */
+const modbus_backend_t _modbus_rtu_tcp_backend = {
+    _MODBUS_BACKEND_TYPE_RTU_TCP,
+    _MODBUS_RTU_HEADER_LENGTH,
+    _MODBUS_RTU_CHECKSUM_LENGTH,
+    MODBUS_RTU_MAX_ADU_LENGTH,
+    _modbus_rtu_set_slave,
+    _modbus_rtu_build_request_basis,
+    _modbus_rtu_build_response_basis,
+    _modbus_rtu_get_response_tid,
+    _modbus_rtu_send_msg_pre,
+    _modbus_tcp_send,
+    _modbus_rtu_tcp_receive,
+    _modbus_tcp_recv,
+    _modbus_rtu_check_integrity,
+    _modbus_rtu_pre_check_confirmation,
+    _modbus_tcp_connect,
+    _modbus_tcp_is_connected,
+    _modbus_tcp_close,
+    _modbus_tcp_flush,
+    _modbus_tcp_select,
+    _modbus_tcp_free
+};
+
 // clang-format on
 
-modbus_t *modbus_new_tcp(const char *ip, int port)
+static modbus_t *new_tcp(const char *ip, int port, const modbus_backend_t *backend)
 {
     modbus_t *ctx;
     modbus_tcp_t *ctx_tcp;
@@ -993,10 +1018,7 @@ modbus_t *modbus_new_tcp(const char *ip, int port)
     }
     _modbus_init_common(ctx);
 
-    /* Could be changed after to reach a remote serial Modbus device */
-    ctx->slave = MODBUS_TCP_SLAVE;
-
-    ctx->backend = &_modbus_tcp_backend;
+    ctx->backend = backend;
 
     ctx->backend_data = (modbus_tcp_t *) malloc(sizeof(modbus_tcp_t));
     if (ctx->backend_data == NULL) {
@@ -1027,10 +1049,29 @@ modbus_t *modbus_new_tcp(const char *ip, int port)
     }
     ctx_tcp->port = port;
     ctx_tcp->t_id = 0;
+    ctx_tcp->confirmation_to_ignore = FALSE;
 
     return ctx;
 }
 
+modbus_t *modbus_new_tcp(const char *ip, int port)
+{
+    modbus_t *ctx = new_tcp(ip, port, &_modbus_tcp_backend);
+
+    if (ctx != NULL) {
+        /* Could be changed after to reach a remote serial Modbus device */
+        ctx->slave = MODBUS_TCP_SLAVE;
+    }
+
+    return ctx;
+}
+
+/* The slave must be set like a RTU context */
+modbus_t *modbus_new_rtu_tcp(const char *ip, int port)
+{
+    return new_tcp(ip, port, &_modbus_rtu_tcp_backend);
+}
+
 modbus_t *modbus_new_tcp_pi(const char *node, const char *service)
 {
     modbus_t *ctx;
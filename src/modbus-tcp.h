@@ -47,6 +47,22 @@ MODBUS_API modbus_t *modbus_new_tcp_pi(const char *node, const char *service);
 MODBUS_API int modbus_tcp_pi_listen(modbus_t *ctx, int nb_connection);
 MODBUS_API int modbus_tcp_pi_accept(modbus_t *ctx, int *s);
 
+/* RTU frames over TCP (serial device servers) */
+MODBUS_API modbus_t *modbus_new_rtu_tcp(const char *ip_address, int port);
+
+typedef struct _modbus_server modbus_server_t;
+
+MODBUS_API modbus_server_t *
+modbus_server_new(modbus_t *ctx, int s, modbus_mapping_t *mb_mapping);
+MODBUS_API modbus_server_t *modbus_server_new_workers(modbus_t *ctx,
+                                                      int nb_connection,
+                                                      int nb_workers,
+                                                      modbus_mapping_t *mb_mapping);
+MODBUS_API int modbus_server_run(modbus_server_t *server);
+MODBUS_API int modbus_server_stop(modbus_server_t *server);
+MODBUS_API int modbus_server_get_nb_connections(modbus_server_t *server);
+MODBUS_API void modbus_server_free(modbus_server_t *server);
+
 MODBUS_END_DECLS
 
 #endif /* MODBUS_TCP_H */
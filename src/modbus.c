@@ -20,6 +20,11 @@
 
 #include <config.h>
 
+#if defined(HAVE_POLL_H) && defined(HAVE_POLL) && !defined(_WIN32)
+#include <poll.h>
+#define USE_POLL
+#endif
+
 #include "modbus-private.h"
 #include "modbus.h"
 
@@ -34,13 +39,6 @@ const unsigned int libmodbus_version_micro = LIBMODBUS_VERSION_MICRO;
 /* Max between RTU and TCP max adu length (so TCP) */
 #define MAX_MESSAGE_LENGTH 260
 
-/* 3 steps are used to parse the query */
-typedef enum {
-    _STEP_FUNCTION,
-    _STEP_META,
-    _STEP_DATA
-} _step_t;
-
 const char *modbus_strerror(int errnum)
 {
     switch (errnum) {
@@ -108,6 +106,158 @@ static void _sleep_response_timeout(modbus_t *ctx)
 #endif
 }
 
+/* Gets a monotonic time, used to compute the deadlines of the transactions */
+void _modbus_get_time(struct timeval *tv)
+{
+#if defined(_WIN32)
+    DWORD ms = GetTickCount();
+    tv->tv_sec = ms / 1000;
+    tv->tv_usec = (ms % 1000) * 1000;
+#elif defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    tv->tv_sec = ts.tv_sec;
+    tv->tv_usec = ts.tv_nsec / 1000;
+#else
+    gettimeofday(tv, NULL);
+#endif
+}
+
+static void _timeval_add(struct timeval *tv, const struct timeval *delta)
+{
+    tv->tv_sec += delta->tv_sec;
+    tv->tv_usec += delta->tv_usec;
+    if (tv->tv_usec >= 1000000) {
+        tv->tv_sec++;
+        tv->tv_usec -= 1000000;
+    }
+}
+
+static int _timeval_cmp(const struct timeval *a, const struct timeval *b)
+{
+    if (a->tv_sec != b->tv_sec)
+        return (a->tv_sec < b->tv_sec) ? -1 : 1;
+    if (a->tv_usec != b->tv_usec)
+        return (a->tv_usec < b->tv_usec) ? -1 : 1;
+    return 0;
+}
+
+/* Sets tv to a - b, a must be greater than b */
+static void
+_timeval_sub(struct timeval *tv, const struct timeval *a, const struct timeval *b)
+{
+    tv->tv_sec = a->tv_sec - b->tv_sec;
+    tv->tv_usec = a->tv_usec - b->tv_usec;
+    if (tv->tv_usec < 0) {
+        tv->tv_sec--;
+        tv->tv_usec += 1000000;
+    }
+}
+
+/* Waits for the file descriptor to be ready for the events (_MODBUS_WAIT_READ
+   and/or _MODBUS_WAIT_WRITE). poll() is used when available so there is no
+   limit on the value of the descriptor (FD_SETSIZE with select()).
+
+   The function shall return a positive value when the descriptor is ready, 0
+   on timeout or -1 on error. When tv isn't NULL, it's updated with the remaining
+   time so the wait can be resumed after EINTR. */
+int _modbus_wait(int fd, int events, struct timeval *tv)
+{
+    int rc;
+    struct timeval deadline;
+    struct timeval now;
+#ifdef USE_POLL
+    struct pollfd pfd;
+#ifdef HAVE_PPOLL
+    struct timespec ts;
+#else
+    int timeout;
+#endif
+#else
+    fd_set set;
+#endif
+
+    if (fd < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (tv != NULL) {
+        _modbus_get_time(&deadline);
+        _timeval_add(&deadline, tv);
+    }
+
+#ifdef USE_POLL
+    pfd.fd = fd;
+    pfd.events = 0;
+    pfd.revents = 0;
+    if (events & _MODBUS_WAIT_READ)
+        pfd.events |= POLLIN;
+    if (events & _MODBUS_WAIT_WRITE)
+        pfd.events |= POLLOUT;
+
+#ifdef HAVE_PPOLL
+    /* Same resolution as select() */
+    if (tv != NULL) {
+        ts.tv_sec = tv->tv_sec;
+        ts.tv_nsec = tv->tv_usec * 1000;
+    }
+    rc = ppoll(&pfd, 1, (tv != NULL) ? &ts : NULL, NULL);
+#else
+    if (tv == NULL) {
+        timeout = -1;
+    } else if (tv->tv_sec >= INT_MAX / 1000) {
+        timeout = INT_MAX;
+    } else {
+        /* Rounded up to not wake up before the end of the timeout */
+        timeout = tv->tv_sec * 1000 + (tv->tv_usec + 999) / 1000;
+    }
+
+    rc = poll(&pfd, 1, timeout);
+#endif
+    if (rc > 0 && (pfd.revents & POLLNVAL)) {
+        errno = EBADF;
+        rc = -1;
+    }
+#else
+#ifndef _WIN32
+    /* The value of the descriptor is the index in the set */
+    if (fd >= FD_SETSIZE) {
+        errno = EINVAL;
+        return -1;
+    }
+#endif
+    FD_ZERO(&set);
+    FD_SET(fd, &set);
+    rc = select(fd + 1,
+                (events & _MODBUS_WAIT_READ) ? &set : NULL,
+                (events & _MODBUS_WAIT_WRITE) ? &set : NULL,
+                NULL,
+                tv);
+#endif
+
+    if (tv != NULL) {
+        _modbus_get_time(&now);
+        if (_timeval_cmp(&deadline, &now) > 0) {
+            _timeval_sub(tv, &deadline, &now);
+        } else {
+            tv->tv_sec = 0;
+            tv->tv_usec = 0;
+        }
+    }
+
+    return rc;
+}
+
+/* Drops the data received in advance */
+static void clear_rx_buffer(modbus_t *ctx)
+{
+    ctx->rx_start = 0;
+    ctx->rx_length = 0;
+    ctx->rx_crc = _MODBUS_CRC16_INIT;
+    ctx->rx_crc_length = 0;
+}
+
 int modbus_flush(modbus_t *ctx)
 {
     int rc;
@@ -117,6 +267,7 @@ int modbus_flush(modbus_t *ctx)
         return -1;
     }
 
+    clear_rx_buffer(ctx);
     rc = ctx->backend->flush(ctx);
     if (rc != -1 && ctx->debug) {
         /* Not all backends are able to return the number of bytes flushed */
@@ -343,9 +494,170 @@ compute_data_length_after_meta(modbus_t *ctx, uint8_t *msg, msg_type_t msg_type)
     return length;
 }
 
+/* Computes the length of the message from its received part. When the received
+   part is too short to know the full length, the returned length is the one
+   required to go further. */
+int _modbus_compute_msg_length(modbus_t *ctx,
+                               uint8_t *msg,
+                               int msg_length,
+                               msg_type_t msg_type)
+{
+    int length = ctx->backend->header_length + 1;
+
+    if (msg_length < length)
+        return length;
+
+    length += compute_meta_length_after_function(msg[ctx->backend->header_length],
+                                                 msg_type);
+    if (msg_length < length)
+        return length;
+
+    return length + compute_data_length_after_meta(ctx, msg, msg_type);
+}
+
+/* Reads the available data of the connection in the receive buffer. Without
+   read ahead, no more than the length of the message is read so the data of the
+   next message stays in the connection. Returns 0 on end of stream or when the
+   serial port has no data. */
+static int fill_rx_buffer(modbus_t *ctx, int msg_length, int read_ahead)
+{
+    int rc;
+    int length_to_read;
+
+    /* Moves the beginning of the message at the start of the buffer */
+    if (ctx->rx_start > 0) {
+        memmove(ctx->rx_buf, ctx->rx_buf + ctx->rx_start, ctx->rx_length);
+        ctx->rx_start = 0;
+    }
+
+    if (read_ahead) {
+        length_to_read = _MODBUS_RX_BUFFER_LENGTH - ctx->rx_length;
+    } else {
+        length_to_read = msg_length - ctx->rx_length;
+    }
+
+    rc = ctx->backend->recv(ctx, ctx->rx_buf + ctx->rx_length, length_to_read);
+    if (rc > 0)
+        ctx->rx_length += rc;
+
+    return rc;
+}
+
+/* Updates the CRC of the message being received with the new data. The
+   checksum isn't included, msg_length is never greater than the full length of
+   the message. */
+static void update_rx_crc(modbus_t *ctx, int msg_length)
+{
+    int length;
+
+    if (ctx->backend->checksum_length == 0)
+        return;
+
+    length = msg_length - ctx->backend->checksum_length;
+    if (length > ctx->rx_length)
+        length = ctx->rx_length;
+
+    if (length > ctx->rx_crc_length) {
+        uint8_t *data = ctx->rx_buf + ctx->rx_start + ctx->rx_crc_length;
+
+        ctx->rx_crc =
+            _modbus_crc16_update(ctx->rx_crc, data, length - ctx->rx_crc_length);
+        ctx->rx_crc_length = length;
+    }
+}
+
+/* Returns TRUE when the CRC, updated up to the checksum, of the message of
+   msg_length bytes at the start of the receive buffer is valid (RTU) */
+static int is_rx_crc_valid(modbus_t *ctx, int msg_length)
+{
+    const uint8_t *msg = ctx->rx_buf + ctx->rx_start;
+
+    return ctx->rx_crc_length == msg_length - 2 &&
+           ctx->rx_crc == ((msg[msg_length - 1] << 8) | msg[msg_length - 2]);
+}
+
+/* Extracts the first message of the receive buffer and checks its integrity */
+static int consume_rx_msg(modbus_t *ctx, uint8_t *msg, int msg_length)
+{
+    int rc;
+
+    memcpy(msg, ctx->rx_buf + ctx->rx_start, msg_length);
+    ctx->rx_length -= msg_length;
+    ctx->rx_start = (ctx->rx_length == 0) ? 0 : ctx->rx_start + msg_length;
+
+    /* Display the hex code of each character received */
+    if (ctx->debug) {
+        int i;
+        for (i = 0; i < msg_length; i++)
+            printf("<%.2X>", msg[i]);
+        printf("\n");
+    }
+
+    rc = ctx->backend->check_integrity(ctx, msg, msg_length);
+
+    /* The CRC of the next message starts from scratch */
+    ctx->rx_crc = _MODBUS_CRC16_INIT;
+    ctx->rx_crc_length = 0;
+
+    return rc;
+}
+
+/* Receives a message without blocking.
+
+   The function shall return the same values as _modbus_receive_msg. When the
+   message isn't fully received, it shall return -1 and set errno to EAGAIN,
+   the received part is kept in the context for the next call.
+*/
+int _modbus_poll_msg(modbus_t *ctx, uint8_t *msg, msg_type_t msg_type)
+{
+    int rc;
+    int msg_length;
+
+    for (;;) {
+        msg_length = _modbus_compute_msg_length(
+            ctx, ctx->rx_buf + ctx->rx_start, ctx->rx_length, msg_type);
+        if (msg_length > (int) ctx->backend->max_adu_length) {
+            clear_rx_buffer(ctx);
+            errno = EMBBADDATA;
+            _error_print(ctx, "too many data");
+            return -1;
+        }
+
+        update_rx_crc(ctx, msg_length);
+        if (ctx->rx_length >= msg_length)
+            return consume_rx_msg(ctx, msg, msg_length);
+
+        rc = fill_rx_buffer(ctx, msg_length, TRUE);
+        if (rc == 0) {
+            /* The serial port is opened without blocking (VMIN = 0) so its read
+               returns 0 when no data is available, a stream is closed */
+            errno = ctx->backend->backend_type == _MODBUS_BACKEND_TYPE_RTU ? EAGAIN
+                                                                            : ECONNRESET;
+            rc = -1;
+        }
+        if (rc == -1) {
+#ifdef _WIN32
+            if (WSAGetLastError() == WSAEWOULDBLOCK)
+                errno = EAGAIN;
+#endif
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                errno = EAGAIN;
+            } else {
+                _error_print(ctx, "read");
+                clear_rx_buffer(ctx);
+            }
+            return -1;
+        }
+    }
+}
+
 /* Waits a response from a modbus server or a request from a modbus client.
    This function blocks if there is no replies (3 timeouts).
 
+   The data are read in a buffer of the context as soon as they are available,
+   so a message is usually received with a single wait and recv().
+   The messages received in advance are kept for the next calls.
+
    The function shall return the number of received characters and the received
    message in an array of uint8_t if successful. Otherwise it shall return -1
    and errno is set to one of the values defined below:
@@ -355,15 +667,15 @@ compute_data_length_after_meta(modbus_t *ctx, uint8_t *msg, msg_type_t msg_type)
    - read() or recv() error codes
 */
 
-int _modbus_receive_msg(modbus_t *ctx, uint8_t *msg, msg_type_t msg_type)
+static int
+receive_msg(modbus_t *ctx, uint8_t *msg, msg_type_t msg_type, struct timeval *p_tv)
 {
     int rc;
-    fd_set rset;
     struct timeval tv;
-    struct timeval *p_tv;
-    unsigned int length_to_read;
-    int msg_length = 0;
-    _step_t step;
+    int msg_length;
+    int read_ahead;
+    int received = FALSE;
+    int silence_framing;
 #ifdef _WIN32
     int wsa_err;
 #endif
@@ -383,44 +695,85 @@ int _modbus_receive_msg(modbus_t *ctx, uint8_t *msg, msg_type_t msg_type)
         return -1;
     }
 
-    /* Add a file descriptor to the set */
-    FD_ZERO(&rset);
-    if (ctx->s < 0 || ctx->s >= FD_SETSIZE) {
-        if (ctx->debug) {
-            fprintf(stderr, "ERROR Invalid socket descriptor %d\n", ctx->s);
-        }
-        errno = EINVAL;
-        return -1;
-    }
-    FD_SET(ctx->s, &rset);
-
-    /* We need to analyse the message step by step.  At the first step, we want
-     * to reach the function code because all packets contain this
-     * information. */
-    step = _STEP_FUNCTION;
-    length_to_read = ctx->backend->header_length + 1;
+    /* A server may share the context between many connections (see
+       modbus_set_socket) so the indications are only read in advance when
+       the context is dedicated to one connection. */
+    read_ahead = (msg_type == MSG_CONFIRMATION || ctx->indication_read_ahead);
+
+    /* The frames are delimited by the silence on the bus, whatever the function
+       code, all the available data are read */
+    silence_framing = ctx->rx_silence.tv_sec > 0 || ctx->rx_silence.tv_usec > 0;
+    if (silence_framing)
+        read_ahead = TRUE;
+
+    for (;;) {
+        msg_length = _modbus_compute_msg_length(
+            ctx, ctx->rx_buf + ctx->rx_start, ctx->rx_length, msg_type);
+        if (silence_framing) {
+            /* A frame of the computed length ends without waiting for the
+               silence when its CRC is valid */
+            update_rx_crc(ctx, msg_length);
+            if (ctx->rx_length >= msg_length && is_rx_crc_valid(ctx, msg_length))
+                break;
 
-    if (msg_type == MSG_INDICATION) {
-        /* Wait for a message, we don't know when the message will be received */
-        if (ctx->indication_timeout.tv_sec == 0 && ctx->indication_timeout.tv_usec == 0) {
-            /* By default, the indication timeout isn't set */
-            p_tv = NULL;
+            msg_length = _MODBUS_RX_BUFFER_LENGTH;
+            if (ctx->rx_length > (int) ctx->backend->max_adu_length) {
+                clear_rx_buffer(ctx);
+                errno = EMBBADDATA;
+                _error_print(ctx, "too many data");
+                return -1;
+            }
         } else {
-            /* Wait for an indication (name of a received request by a server, see schema)
-             */
-            tv.tv_sec = ctx->indication_timeout.tv_sec;
-            tv.tv_usec = ctx->indication_timeout.tv_usec;
+            if (msg_length > (int) ctx->backend->max_adu_length) {
+                clear_rx_buffer(ctx);
+                errno = EMBBADDATA;
+                _error_print(ctx, "too many data");
+                return -1;
+            }
+
+            /* The CRC is computed on each chunk while the next ones are
+               awaited */
+            update_rx_crc(ctx, msg_length);
+            if (ctx->rx_length >= msg_length)
+                break;
+        }
+
+        if (silence_framing && ctx->rx_length > 0) {
+            /* The silence after the last character ends the frame */
+            tv.tv_sec = ctx->rx_silence.tv_sec;
+            tv.tv_usec = ctx->rx_silence.tv_usec;
+            p_tv = &tv;
+        } else if (received &&
+            (ctx->byte_timeout.tv_sec > 0 || ctx->byte_timeout.tv_usec > 0)) {
+            /* If there is no character in the buffer, the allowed timeout
+               interval between two consecutive bytes is defined by
+               byte_timeout */
+            tv.tv_sec = ctx->byte_timeout.tv_sec;
+            tv.tv_usec = ctx->byte_timeout.tv_usec;
             p_tv = &tv;
         }
-    } else {
-        tv.tv_sec = ctx->response_timeout.tv_sec;
-        tv.tv_usec = ctx->response_timeout.tv_usec;
-        p_tv = &tv;
-    }
+        /* else timeout isn't set again, the full response must be read before
+           expiration of response timeout (for CONFIRMATION only) */
 
-    while (length_to_read != 0) {
-        rc = ctx->backend->select(ctx, &rset, p_tv, length_to_read);
+        rc = ctx->backend->select(ctx, p_tv, msg_length - ctx->rx_length);
+        if (rc == -1 && silence_framing && ctx->rx_length > 0 && errno == ETIMEDOUT) {
+            /* The bus is quiet, the frame is complete */
+            msg_length = ctx->rx_length;
+            if (msg_length <
+                (int) (ctx->backend->header_length + 1 + ctx->backend->checksum_length)) {
+                clear_rx_buffer(ctx);
+                errno = EMBBADDATA;
+                _error_print(ctx, "too short frame");
+                return -1;
+            }
+            break;
+        }
         if (rc == -1) {
+            /* The part of a frame received before the silence of a serial line
+               can't be completed, it would corrupt the next message. The
+               stream of a TCP connection keeps it for the next call. */
+            if (ctx->backend->checksum_length > 0)
+                clear_rx_buffer(ctx);
             _error_print(ctx, "select");
             if (ctx->error_recovery & MODBUS_ERROR_RECOVERY_LINK) {
 #ifdef _WIN32
@@ -447,13 +800,13 @@ int _modbus_receive_msg(modbus_t *ctx, uint8_t *msg, msg_type_t msg_type)
             return -1;
         }
 
-        rc = ctx->backend->recv(ctx, msg + msg_length, length_to_read);
+        rc = fill_rx_buffer(ctx, msg_length, read_ahead);
         if (rc == 0) {
             errno = ECONNRESET;
             rc = -1;
         }
-
         if (rc == -1) {
+            clear_rx_buffer(ctx);
             _error_print(ctx, "read");
 #ifdef _WIN32
             wsa_err = WSAGetLastError();
@@ -477,60 +830,36 @@ int _modbus_receive_msg(modbus_t *ctx, uint8_t *msg, msg_type_t msg_type)
 #endif
             return -1;
         }
+        received = TRUE;
+    }
 
-        /* Display the hex code of each character received */
-        if (ctx->debug) {
-            int i;
-            for (i = 0; i < rc; i++)
-                printf("<%.2X>", msg[msg_length + i]);
-        }
-
-        /* Sums bytes received */
-        msg_length += rc;
-        /* Computes remaining bytes */
-        length_to_read -= rc;
-
-        if (length_to_read == 0) {
-            switch (step) {
-            case _STEP_FUNCTION:
-                /* Function code position */
-                length_to_read = compute_meta_length_after_function(
-                    msg[ctx->backend->header_length], msg_type);
-                if (length_to_read != 0) {
-                    step = _STEP_META;
-                    break;
-                } /* else switches straight to the next step */
-            case _STEP_META:
-                length_to_read = compute_data_length_after_meta(ctx, msg, msg_type);
-                if ((msg_length + length_to_read) > ctx->backend->max_adu_length) {
-                    errno = EMBBADDATA;
-                    _error_print(ctx, "too many data");
-                    return -1;
-                }
-                step = _STEP_DATA;
-                break;
-            default:
-                break;
-            }
-        }
+    return consume_rx_msg(ctx, msg, msg_length);
+}
 
-        if (length_to_read > 0 &&
-            (ctx->byte_timeout.tv_sec > 0 || ctx->byte_timeout.tv_usec > 0)) {
-            /* If there is no character in the buffer, the allowed timeout
-               interval between two consecutive bytes is defined by
-               byte_timeout */
-            tv.tv_sec = ctx->byte_timeout.tv_sec;
-            tv.tv_usec = ctx->byte_timeout.tv_usec;
+int _modbus_receive_msg(modbus_t *ctx, uint8_t *msg, msg_type_t msg_type)
+{
+    struct timeval tv;
+    struct timeval *p_tv;
+
+    if (msg_type == MSG_INDICATION) {
+        /* Wait for a message, we don't know when the message will be received */
+        if (ctx->indication_timeout.tv_sec == 0 && ctx->indication_timeout.tv_usec == 0) {
+            /* By default, the indication timeout isn't set */
+            p_tv = NULL;
+        } else {
+            /* Wait for an indication (name of a received request by a server, see schema)
+             */
+            tv.tv_sec = ctx->indication_timeout.tv_sec;
+            tv.tv_usec = ctx->indication_timeout.tv_usec;
             p_tv = &tv;
         }
-        /* else timeout isn't set again, the full response must be read before
-           expiration of response timeout (for CONFIRMATION only) */
+    } else {
+        tv.tv_sec = ctx->response_timeout.tv_sec;
+        tv.tv_usec = ctx->response_timeout.tv_usec;
+        p_tv = &tv;
     }
 
-    if (ctx->debug)
-        printf("\n");
-
-    return ctx->backend->check_integrity(ctx, msg, msg_length);
+    return receive_msg(ctx, msg, msg_type, p_tv);
 }
 
 /* Receive the request from a modbus master */
@@ -721,29 +1050,85 @@ static int check_confirmation(modbus_t *ctx, uint8_t *req, uint8_t *rsp, int rsp
     return rc;
 }
 
+/* Reads a register of the mapping in the processor-endianness */
+static uint16_t
+get_mapping_register(const modbus_mapping_t *mb_mapping, const uint16_t *tab, int idx)
+{
+    if (mb_mapping->flags & MODBUS_MAPPING_WIRE_ORDER) {
+        const uint8_t *value = (const uint8_t *) (tab + idx);
+        return (value[0] << 8) | value[1];
+    }
+
+    return tab[idx];
+}
+
+/* Returns the index in the table of the mapping of the nb values at address.
+   The result must be checked against the size of the table by the caller, -1
+   is returned when the values don't belong to a segment of the mapping. */
 static int
-response_io_status(uint8_t *tab_io_status, int address, int nb, uint8_t *rsp, int offset)
+get_mapping_index(const modbus_mapping_t *mb_mapping, int table, int address, int nb)
 {
-    int shift = 0;
-    /* Instead of byte (not allowed in Win32) */
-    int one_byte = 0;
-    int i;
+    const modbus_mapping_ext_t *ext;
+    const modbus_mapping_segment_t *segments;
+    int low;
+    int high;
+
+    if (!(mb_mapping->flags & MODBUS_MAPPING_SEGMENTED)) {
+        switch (table) {
+        case MODBUS_TABLE_BITS:
+            return address - mb_mapping->start_bits;
+        case MODBUS_TABLE_INPUT_BITS:
+            return address - mb_mapping->start_input_bits;
+        case MODBUS_TABLE_REGISTERS:
+            return address - mb_mapping->start_registers;
+        default:
+            return address - mb_mapping->start_input_registers;
+        }
+    }
+
+    /* Binary search of the segment containing address */
+    ext = (const modbus_mapping_ext_t *) mb_mapping->ext;
+    segments = ext->segments[table];
+    low = 0;
+    high = ext->nb_segments[table] - 1;
+    while (low <= high) {
+        int middle = (low + high) / 2;
 
-    for (i = address; i < address + nb; i++) {
-        one_byte |= tab_io_status[i] << shift;
-        if (shift == 7) {
-            /* Byte is full */
-            rsp[offset++] = one_byte;
-            one_byte = shift = 0;
+        if (address < segments[middle].start) {
+            high = middle - 1;
+        } else if (address >= segments[middle].start + segments[middle].nb) {
+            low = middle + 1;
+        } else if (address + nb > segments[middle].start + segments[middle].nb) {
+            return -1;
         } else {
-            shift++;
+            return segments[middle].index + address - segments[middle].start;
         }
     }
 
-    if (shift != 0)
-        rsp[offset++] = one_byte;
+    return -1;
+}
+
+/* Writes a register of the mapping from a value in the processor-endianness */
+static void set_mapping_register(const modbus_mapping_t *mb_mapping,
+                                 uint16_t *tab,
+                                 int idx,
+                                 int value)
+{
+    if (mb_mapping->flags & MODBUS_MAPPING_WIRE_ORDER) {
+        uint8_t *dest = (uint8_t *) (tab + idx);
+        dest[0] = (value >> 8) & 0xFF;
+        dest[1] = value & 0xFF;
+    } else {
+        tab[idx] = value;
+    }
+}
+
+static int
+response_io_status(uint8_t *tab_io_status, int address, int nb, uint8_t *rsp, int offset)
+{
+    _modbus_pack_bits(rsp + offset, tab_io_status + address, nb);
 
-    return offset;
+    return offset + (nb / 8) + ((nb % 8) ? 1 : 0);
 }
 
 /* Build the exception response */
@@ -766,9 +1151,10 @@ static int response_exception(modbus_t *ctx,
         va_end(ap);
     }
 
-    /* Flush if required */
+    /* Flush if required, a context driven by an event loop must not sleep */
     if (to_flush) {
-        _sleep_response_timeout(ctx);
+        if (!ctx->event_driven)
+            _sleep_response_timeout(ctx);
         modbus_flush(ctx);
     }
 
@@ -780,30 +1166,36 @@ static int response_exception(modbus_t *ctx,
     return rsp_length;
 }
 
-/* Send a response to the received request.
-   Analyses the request and constructs a response.
+/* Suppress any responses in RTU when the request was a broadcast, excepted when
+ * quirk is enabled. */
+static int is_response_suppressed(modbus_t *ctx, int slave)
+{
+    return (ctx->backend->backend_type == _MODBUS_BACKEND_TYPE_RTU ||
+            ctx->backend->backend_type == _MODBUS_BACKEND_TYPE_RTU_TCP) &&
+           slave == MODBUS_BROADCAST_ADDRESS &&
+           !(ctx->quirks & MODBUS_QUIRK_REPLY_TO_BROADCAST);
+}
+
+/* Analyses the request and constructs the response in rsp (at least
+   MAX_MESSAGE_LENGTH bytes).
 
    If an error occurs, this function construct the response
-   accordingly.
+   accordingly. Returns the length of the response or 0 when no response must
+   be sent.
 */
-int modbus_reply(modbus_t *ctx,
-                 const uint8_t *req,
-                 int req_length,
-                 modbus_mapping_t *mb_mapping)
+static int build_reply(modbus_t *ctx,
+                       const uint8_t *req,
+                       int req_length,
+                       modbus_mapping_t *mb_mapping,
+                       uint8_t *rsp)
 {
     unsigned int offset;
     int slave;
     int function;
     uint16_t address;
-    uint8_t rsp[MAX_MESSAGE_LENGTH];
     int rsp_length = 0;
     sft_t sft;
 
-    if (ctx == NULL) {
-        errno = EINVAL;
-        return -1;
-    }
-
     offset = ctx->backend->header_length;
     slave = req[offset - 1];
     function = req[offset];
@@ -827,14 +1219,17 @@ int modbus_reply(modbus_t *ctx,
     case MODBUS_FC_READ_COILS:
     case MODBUS_FC_READ_DISCRETE_INPUTS: {
         unsigned int is_input = (function == MODBUS_FC_READ_DISCRETE_INPUTS);
-        int start_bits = is_input ? mb_mapping->start_input_bits : mb_mapping->start_bits;
         int nb_bits = is_input ? mb_mapping->nb_input_bits : mb_mapping->nb_bits;
         uint8_t *tab_bits = is_input ? mb_mapping->tab_input_bits : mb_mapping->tab_bits;
         const char *const name = is_input ? "read_input_bits" : "read_bits";
         int nb = (req[offset + 3] << 8) + req[offset + 4];
         /* The mapping can be shifted to reduce memory consumption and it
            doesn't always start at address zero. */
-        int mapping_address = address - start_bits;
+        int mapping_address =
+            get_mapping_index(mb_mapping,
+                              is_input ? MODBUS_TABLE_INPUT_BITS : MODBUS_TABLE_BITS,
+                              address,
+                              nb);
 
         if (nb < 1 || MODBUS_MAX_READ_BITS < nb) {
             rsp_length = response_exception(ctx,
@@ -858,15 +1253,19 @@ int modbus_reply(modbus_t *ctx,
         } else {
             rsp_length = ctx->backend->build_response_basis(&sft, rsp);
             rsp[rsp_length++] = (nb / 8) + ((nb % 8) ? 1 : 0);
-            rsp_length =
-                response_io_status(tab_bits, mapping_address, nb, rsp, rsp_length);
+            if (mb_mapping->flags & MODBUS_MAPPING_PACKED_BITS) {
+                /* Straight copy when the address is aligned on a byte */
+                _modbus_get_packed_bits(rsp + rsp_length, tab_bits, mapping_address, nb);
+                rsp_length += (nb / 8) + ((nb % 8) ? 1 : 0);
+            } else {
+                rsp_length =
+                    response_io_status(tab_bits, mapping_address, nb, rsp, rsp_length);
+            }
         }
     } break;
     case MODBUS_FC_READ_HOLDING_REGISTERS:
     case MODBUS_FC_READ_INPUT_REGISTERS: {
         unsigned int is_input = (function == MODBUS_FC_READ_INPUT_REGISTERS);
-        int start_registers =
-            is_input ? mb_mapping->start_input_registers : mb_mapping->start_registers;
         int nb_registers =
             is_input ? mb_mapping->nb_input_registers : mb_mapping->nb_registers;
         uint16_t *tab_registers =
@@ -875,7 +1274,11 @@ int modbus_reply(modbus_t *ctx,
         int nb = (req[offset + 3] << 8) + req[offset + 4];
         /* The mapping can be shifted to reduce memory consumption and it
            doesn't always start at address zero. */
-        int mapping_address = address - start_registers;
+        int mapping_address = get_mapping_index(
+            mb_mapping,
+            is_input ? MODBUS_TABLE_INPUT_REGISTERS : MODBUS_TABLE_REGISTERS,
+            address,
+            nb);
 
         if (nb < 1 || MODBUS_MAX_READ_REGISTERS < nb) {
             rsp_length = response_exception(ctx,
@@ -901,14 +1304,20 @@ int modbus_reply(modbus_t *ctx,
 
             rsp_length = ctx->backend->build_response_basis(&sft, rsp);
             rsp[rsp_length++] = nb << 1;
-            for (i = mapping_address; i < mapping_address + nb; i++) {
-                rsp[rsp_length++] = tab_registers[i] >> 8;
-                rsp[rsp_length++] = tab_registers[i] & 0xFF;
+            if (mb_mapping->flags & MODBUS_MAPPING_WIRE_ORDER) {
+                memcpy(rsp + rsp_length, tab_registers + mapping_address, nb << 1);
+                rsp_length += nb << 1;
+            } else {
+                for (i = mapping_address; i < mapping_address + nb; i++) {
+                    rsp[rsp_length++] = tab_registers[i] >> 8;
+                    rsp[rsp_length++] = tab_registers[i] & 0xFF;
+                }
             }
         }
     } break;
     case MODBUS_FC_WRITE_SINGLE_COIL: {
-        int mapping_address = address - mb_mapping->start_bits;
+        int mapping_address =
+            get_mapping_index(mb_mapping, MODBUS_TABLE_BITS, address, 1);
 
         if (mapping_address < 0 || mapping_address >= mb_mapping->nb_bits) {
             rsp_length = response_exception(ctx,
@@ -943,7 +1352,13 @@ int modbus_reply(modbus_t *ctx,
         int data = (req[offset + 3] << 8) + req[offset + 4];
         if (data == 0xFF00 || data == 0x0) {
             /* Apply the change to mapping */
-            mb_mapping->tab_bits[mapping_address] = data ? ON : OFF;
+            if (mb_mapping->flags & MODBUS_MAPPING_PACKED_BITS) {
+                uint8_t status = data ? ON : OFF;
+                _modbus_set_packed_bits(
+                    mb_mapping->tab_bits, mapping_address, &status, 1);
+            } else {
+                mb_mapping->tab_bits[mapping_address] = data ? ON : OFF;
+            }
             /* Prepare response */
             memcpy(rsp, req, rsp_length);
         } else {
@@ -959,7 +1374,8 @@ int modbus_reply(modbus_t *ctx,
         }
     } break;
     case MODBUS_FC_WRITE_SINGLE_REGISTER: {
-        int mapping_address = address - mb_mapping->start_registers;
+        int mapping_address =
+            get_mapping_index(mb_mapping, MODBUS_TABLE_REGISTERS, address, 1);
 
         if (mapping_address < 0 || mapping_address >= mb_mapping->nb_registers) {
             rsp_length =
@@ -988,7 +1404,8 @@ int modbus_reply(modbus_t *ctx,
         }
         int data = (req[offset + 3] << 8) + req[offset + 4];
 
-        mb_mapping->tab_registers[mapping_address] = data;
+        set_mapping_register(
+            mb_mapping, mb_mapping->tab_registers, mapping_address, data);
 
         rsp_length -= ctx->backend->checksum_length;
         memcpy(rsp, req, rsp_length);
@@ -996,7 +1413,8 @@ int modbus_reply(modbus_t *ctx,
     case MODBUS_FC_WRITE_MULTIPLE_COILS: {
         int nb = (req[offset + 3] << 8) + req[offset + 4];
         int nb_bits = req[offset + 5];
-        int mapping_address = address - mb_mapping->start_bits;
+        int mapping_address =
+            get_mapping_index(mb_mapping, MODBUS_TABLE_BITS, address, nb);
 
         if (nb < 1 || MODBUS_MAX_WRITE_BITS < nb || nb_bits * 8 < nb) {
             /* May be the indication has been truncated on reading because of
@@ -1021,8 +1439,13 @@ int modbus_reply(modbus_t *ctx,
                                             mapping_address < 0 ? address : address + nb);
         } else {
             /* 6 = byte count */
-            modbus_set_bits_from_bytes(
-                mb_mapping->tab_bits, mapping_address, nb, &req[offset + 6]);
+            if (mb_mapping->flags & MODBUS_MAPPING_PACKED_BITS) {
+                _modbus_set_packed_bits(
+                    mb_mapping->tab_bits, mapping_address, &req[offset + 6], nb);
+            } else {
+                modbus_set_bits_from_bytes(
+                    mb_mapping->tab_bits, mapping_address, nb, &req[offset + 6]);
+            }
 
             rsp_length = ctx->backend->build_response_basis(&sft, rsp);
             /* 4 to copy the bit address (2) and the quantity of bits */
@@ -1033,7 +1456,8 @@ int modbus_reply(modbus_t *ctx,
     case MODBUS_FC_WRITE_MULTIPLE_REGISTERS: {
         int nb = (req[offset + 3] << 8) + req[offset + 4];
         int nb_bytes = req[offset + 5];
-        int mapping_address = address - mb_mapping->start_registers;
+        int mapping_address =
+            get_mapping_index(mb_mapping, MODBUS_TABLE_REGISTERS, address, nb);
 
         if (nb < 1 || MODBUS_MAX_WRITE_REGISTERS < nb || nb_bytes != nb * 2) {
             rsp_length = response_exception(
@@ -1057,10 +1481,18 @@ int modbus_reply(modbus_t *ctx,
                                    mapping_address < 0 ? address : address + nb);
         } else {
             int i, j;
-            for (i = mapping_address, j = 6; i < mapping_address + nb; i++, j += 2) {
-                /* 6 and 7 = first value */
-                mb_mapping->tab_registers[i] =
-                    (req[offset + j] << 8) + req[offset + j + 1];
+
+            if (mb_mapping->flags & MODBUS_MAPPING_WIRE_ORDER) {
+                memcpy(mb_mapping->tab_registers + mapping_address,
+                       &req[offset + 6],
+                       nb << 1);
+            } else {
+                for (i = mapping_address, j = 6; i < mapping_address + nb;
+                     i++, j += 2) {
+                    /* 6 and 7 = first value */
+                    mb_mapping->tab_registers[i] =
+                        (req[offset + j] << 8) + req[offset + j + 1];
+                }
             }
 
             rsp_length = ctx->backend->build_response_basis(&sft, rsp);
@@ -1094,7 +1526,8 @@ int modbus_reply(modbus_t *ctx,
                                         "Unsupported function: READ EXCEPTION STATUS (0x07)\n");
         break;
     case MODBUS_FC_MASK_WRITE_REGISTER: {
-        int mapping_address = address - mb_mapping->start_registers;
+        int mapping_address =
+            get_mapping_index(mb_mapping, MODBUS_TABLE_REGISTERS, address, 1);
 
         if (mapping_address < 0 || mapping_address >= mb_mapping->nb_registers) {
             rsp_length =
@@ -1106,12 +1539,14 @@ int modbus_reply(modbus_t *ctx,
                                    "Illegal data address 0x%0X in write_register\n",
                                    address);
         } else {
-            uint16_t data = mb_mapping->tab_registers[mapping_address];
+            uint16_t data = get_mapping_register(
+                mb_mapping, mb_mapping->tab_registers, mapping_address);
             uint16_t and = (req[offset + 3] << 8) + req[offset + 4];
             uint16_t or = (req[offset + 5] << 8) + req[offset + 6];
 
             data = (data & and) | (or & (~and));
-            mb_mapping->tab_registers[mapping_address] = data;
+            set_mapping_register(
+                mb_mapping, mb_mapping->tab_registers, mapping_address, data);
 
             rsp_length = compute_response_length_from_request(ctx, (uint8_t *) req);
             if (rsp_length != req_length) {
@@ -1136,8 +1571,10 @@ int modbus_reply(modbus_t *ctx,
         uint16_t address_write = (req[offset + 5] << 8) + req[offset + 6];
         int nb_write = (req[offset + 7] << 8) + req[offset + 8];
         int nb_write_bytes = req[offset + 9];
-        int mapping_address = address - mb_mapping->start_registers;
-        int mapping_address_write = address_write - mb_mapping->start_registers;
+        int mapping_address =
+            get_mapping_index(mb_mapping, MODBUS_TABLE_REGISTERS, address, nb);
+        int mapping_address_write = get_mapping_index(
+            mb_mapping, MODBUS_TABLE_REGISTERS, address_write, nb_write);
 
         if (nb_write < 1 || MODBUS_MAX_WR_WRITE_REGISTERS < nb_write || nb < 1 ||
             MODBUS_MAX_WR_READ_REGISTERS < nb || nb_write_bytes != nb_write * 2) {
@@ -1172,6 +1609,19 @@ int modbus_reply(modbus_t *ctx,
             rsp_length = ctx->backend->build_response_basis(&sft, rsp);
             rsp[rsp_length++] = nb << 1;
 
+            if (mb_mapping->flags & MODBUS_MAPPING_WIRE_ORDER) {
+                /* Write first, 10 is the offset of the first value to write, and
+                   read the data for the response */
+                memcpy(mb_mapping->tab_registers + mapping_address_write,
+                       &req[offset + 10],
+                       nb_write << 1);
+                memcpy(rsp + rsp_length,
+                       mb_mapping->tab_registers + mapping_address,
+                       nb << 1);
+                rsp_length += nb << 1;
+                break;
+            }
+
             /* Write first.
                10 and 11 are the offset of the first values to write */
             for (i = mapping_address_write, j = 10; i < mapping_address_write + nb_write;
@@ -1199,16 +1649,373 @@ int modbus_reply(modbus_t *ctx,
         break;
     }
 
-    /* Suppress any responses in RTU when the request was a broadcast, excepted when
-     * quirk is enabled. */
-    if (ctx->backend->backend_type == _MODBUS_BACKEND_TYPE_RTU &&
-        slave == MODBUS_BROADCAST_ADDRESS &&
-        !(ctx->quirks & MODBUS_QUIRK_REPLY_TO_BROADCAST)) {
+    if (is_response_suppressed(ctx, slave))
+        return 0;
+
+    return rsp_length;
+}
+
+/* Returns the handler of the function or NULL if it's replied from the mapping */
+static const modbus_reply_handler_entry_t *get_reply_handler(modbus_t *ctx,
+                                                             int function)
+{
+    if (ctx->reply_handlers == NULL || function >= _MODBUS_NB_REPLY_HANDLERS ||
+        ctx->reply_handlers[function].handler == NULL)
+        return NULL;
+
+    return &ctx->reply_handlers[function];
+}
+
+/* Builds the response of a request replied by a handler of the application, the
+   values are read or written in place in the frames. */
+static int
+build_handler_reply(modbus_t *ctx, const uint8_t *req, int req_length, uint8_t *rsp)
+{
+    unsigned int offset = ctx->backend->header_length;
+    int slave = req[offset - 1];
+    int function = req[offset];
+    const modbus_reply_handler_entry_t *entry = get_reply_handler(ctx, function);
+    int address = (req[offset + 1] << 8) + req[offset + 2];
+    int nb = (req[offset + 3] << 8) + req[offset + 4];
+    int nb_max;
+    const uint8_t *values = NULL;
+    uint8_t *dest = NULL;
+    int rsp_length;
+    int rc;
+    sft_t sft;
+    modbus_handler_call_t call;
+
+    sft.slave = slave;
+    sft.function = function;
+    sft.t_id = ctx->backend->get_response_tid(req);
+
+    switch (function) {
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE_INPUTS:
+        nb_max = MODBUS_MAX_READ_BITS;
+        break;
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
+    case MODBUS_FC_READ_INPUT_REGISTERS:
+        nb_max = MODBUS_MAX_READ_REGISTERS;
+        break;
+    case MODBUS_FC_WRITE_SINGLE_COIL:
+        nb_max = 1;
+        if (nb != 0xFF00 && nb != 0x0) {
+            return response_exception(
+                ctx,
+                &sft,
+                MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE,
+                rsp,
+                FALSE,
+                "Illegal data value 0x%0X in write_bit request at address %0X\n",
+                nb,
+                address);
+        }
+        values = req + offset + 3;
+        nb = 1;
+        break;
+    case MODBUS_FC_WRITE_SINGLE_REGISTER:
+        nb_max = 1;
+        values = req + offset + 3;
+        nb = 1;
+        break;
+    case MODBUS_FC_WRITE_MULTIPLE_COILS:
+        nb_max = MODBUS_MAX_WRITE_BITS;
+        if (req[offset + 5] * 8 < nb)
+            nb = 0;
+        values = req + offset + 6;
+        break;
+    default:
+        /* MODBUS_FC_WRITE_MULTIPLE_REGISTERS */
+        nb_max = MODBUS_MAX_WRITE_REGISTERS;
+        if (req[offset + 5] != nb * 2)
+            nb = 0;
+        values = req + offset + 6;
+        break;
+    }
+
+    if (nb < 1 || nb_max < nb) {
+        return response_exception(ctx,
+                                  &sft,
+                                  MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE,
+                                  rsp,
+                                  TRUE,
+                                  "Illegal nb of values %d in function 0x%0X (max %d)\n",
+                                  nb,
+                                  function,
+                                  nb_max);
+    }
+
+    if (function == MODBUS_FC_WRITE_SINGLE_COIL ||
+        function == MODBUS_FC_WRITE_SINGLE_REGISTER) {
+        /* The response is a copy of the request */
+        rsp_length = compute_response_length_from_request(ctx, (uint8_t *) req);
+        if (rsp_length != req_length) {
+            return response_exception(ctx,
+                                      &sft,
+                                      MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE,
+                                      rsp,
+                                      FALSE,
+                                      "Invalid request length in modbus_reply (%d)\n",
+                                      req_length);
+        }
+        rsp_length -= ctx->backend->checksum_length;
+        memcpy(rsp, req, rsp_length);
+    } else {
+        rsp_length = ctx->backend->build_response_basis(&sft, rsp);
+        if (values == NULL) {
+            int nb_bytes = (function == MODBUS_FC_READ_COILS ||
+                            function == MODBUS_FC_READ_DISCRETE_INPUTS)
+                               ? (nb / 8) + ((nb % 8) ? 1 : 0)
+                               : nb * 2;
+
+            rsp[rsp_length++] = nb_bytes;
+            dest = rsp + rsp_length;
+            memset(dest, 0, nb_bytes);
+            rsp_length += nb_bytes;
+        } else {
+            /* Address and quantity */
+            memcpy(rsp + rsp_length, req + rsp_length, 4);
+            rsp_length += 4;
+        }
+    }
+
+    call.sft = sft;
+    call.rsp = rsp;
+    call.rsp_length = rsp_length;
+    call.dest = dest;
+    call.suppressed = is_response_suppressed(ctx, slave);
+    call.deferred = NULL;
+    ctx->handler_call = &call;
+    rc = entry->handler(ctx, function, address, nb, values, dest, entry->user_data);
+    ctx->handler_call = NULL;
+
+    /* The response is sent by modbus_deferred_reply */
+    if (call.deferred != NULL)
+        return 0;
+
+    if (rc != 0) {
+        return response_exception(ctx,
+                                  &sft,
+                                  rc > 0 ? rc : MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE,
+                                  rsp,
+                                  FALSE,
+                                  "Exception 0x%0X of the handler of function 0x%0X\n",
+                                  rc,
+                                  function);
+    }
+
+    if (is_response_suppressed(ctx, slave))
         return 0;
+
+    return rsp_length;
+}
+
+/* Returns TRUE if the function modifies the mapping */
+int _modbus_is_write_function(int function)
+{
+    switch (function) {
+    case MODBUS_FC_WRITE_SINGLE_COIL:
+    case MODBUS_FC_WRITE_SINGLE_REGISTER:
+    case MODBUS_FC_WRITE_MULTIPLE_COILS:
+    case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
+    case MODBUS_FC_MASK_WRITE_REGISTER:
+    case MODBUS_FC_WRITE_AND_READ_REGISTERS:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+/* Builds the response in rsp and returns its length (0 if there is nothing to
+   send). The accesses to a synchronized mapping are protected by its sequence
+   lock, a read is done again if a writer has modified the mapping meanwhile. */
+int _modbus_build_reply(modbus_t *ctx,
+                        const uint8_t *req,
+                        int req_length,
+                        modbus_mapping_t *mb_mapping,
+                        uint8_t *rsp)
+{
+    unsigned int seq;
+    int rc;
+
+    /* The handler is called once, without lock of the mapping */
+    if (get_reply_handler(ctx, req[ctx->backend->header_length]) != NULL)
+        return build_handler_reply(ctx, req, req_length, rsp);
+
+    if (mb_mapping == NULL || !(mb_mapping->flags & MODBUS_MAPPING_SYNC))
+        return build_reply(ctx, req, req_length, mb_mapping, rsp);
+
+    if (_modbus_is_write_function(req[ctx->backend->header_length])) {
+        modbus_mapping_write_begin(mb_mapping);
+        rc = build_reply(ctx, req, req_length, mb_mapping, rsp);
+        modbus_mapping_write_end(mb_mapping);
+    } else {
+        do {
+            seq = modbus_mapping_read_begin(mb_mapping);
+            rc = build_reply(ctx, req, req_length, mb_mapping, rsp);
+        } while (modbus_mapping_read_retry(mb_mapping, seq));
+    }
+
+    return rc;
+}
+
+/* Send a response to the received request.
+   Analyses the request and constructs a response.
+
+   If an error occurs, this function construct the response
+   accordingly.
+*/
+int modbus_reply(modbus_t *ctx,
+                 const uint8_t *req,
+                 int req_length,
+                 modbus_mapping_t *mb_mapping)
+{
+    uint8_t rsp[MAX_MESSAGE_LENGTH];
+    int rsp_length;
+
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
     }
+
+    rsp_length = _modbus_build_reply(ctx, req, req_length, mb_mapping, rsp);
+    if (rsp_length == 0)
+        return 0;
+
     return send_msg(ctx, rsp, rsp_length);
 }
 
+/* Replies the requests of the function with the handler instead of the mapping,
+   the handler is removed when NULL. */
+int modbus_set_reply_handler(modbus_t *ctx,
+                             int function,
+                             modbus_reply_handler_t handler,
+                             void *user_data)
+{
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    switch (function) {
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE_INPUTS:
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
+    case MODBUS_FC_READ_INPUT_REGISTERS:
+    case MODBUS_FC_WRITE_SINGLE_COIL:
+    case MODBUS_FC_WRITE_SINGLE_REGISTER:
+    case MODBUS_FC_WRITE_MULTIPLE_COILS:
+    case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
+        break;
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (ctx->reply_handlers == NULL) {
+        if (handler == NULL)
+            return 0;
+
+        ctx->reply_handlers = (modbus_reply_handler_entry_t *) calloc(
+            _MODBUS_NB_REPLY_HANDLERS, sizeof(modbus_reply_handler_entry_t));
+        if (ctx->reply_handlers == NULL)
+            return -1;
+    }
+
+    ctx->reply_handlers[function].handler = handler;
+    ctx->reply_handlers[function].user_data = user_data;
+
+    return 0;
+}
+
+/* Defers the response of the request replied by the handler in progress. The
+   returned response is completed by modbus_deferred_reply. */
+modbus_deferred_t *modbus_reply_defer(modbus_t *ctx)
+{
+    modbus_handler_call_t *call;
+    modbus_deferred_t *deferred;
+
+    if (ctx == NULL || ctx->handler_call == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    call = ctx->handler_call;
+    if (call->deferred != NULL)
+        return call->deferred;
+
+    deferred = (modbus_deferred_t *) malloc(sizeof(modbus_deferred_t));
+    if (deferred == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    /* The header of the response is already built */
+    deferred->ctx = ctx;
+    deferred->sft = call->sft;
+    memcpy(deferred->rsp, call->rsp, call->rsp_length);
+    deferred->rsp_length = call->rsp_length;
+    deferred->dest =
+        call->dest != NULL ? deferred->rsp + (call->dest - call->rsp) : NULL;
+    deferred->suppressed = call->suppressed;
+    deferred->next = NULL;
+    call->deferred = deferred;
+    if (ctx->server_conn != NULL)
+        _modbus_server_defer(deferred);
+
+    return deferred;
+}
+
+/* Returns the buffer of the values to read of a deferred response (NULL for a
+   write function) */
+uint8_t *modbus_deferred_get_dest(modbus_deferred_t *deferred)
+{
+    if (deferred == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return deferred->dest;
+}
+
+/* Sends the deferred response, or the exception response when exception_code
+   isn't 0, and frees it. In a server engine, the response is queued to the
+   thread of the connection so any thread can complete it. Otherwise it's sent
+   on the context, the calls must be serialized with its other uses. */
+int modbus_deferred_reply(modbus_deferred_t *deferred, int exception_code)
+{
+    modbus_t *ctx;
+    int rc;
+
+    if (deferred == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ctx = deferred->ctx;
+    if (exception_code != 0) {
+        deferred->rsp_length = response_exception(
+            ctx,
+            &deferred->sft,
+            exception_code > 0 ? exception_code
+                               : MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE,
+            deferred->rsp,
+            FALSE,
+            "Exception 0x%0X of the deferred response of function 0x%0X\n",
+            exception_code,
+            deferred->sft.function);
+    }
+
+    if (ctx->server_conn != NULL)
+        return _modbus_server_complete(deferred);
+
+    rc = deferred->suppressed ? 0 : send_msg(ctx, deferred->rsp, deferred->rsp_length);
+    free(deferred);
+
+    return rc == -1 ? -1 : 0;
+}
+
 int modbus_reply_exception(modbus_t *ctx, const uint8_t *req, unsigned int exception_code)
 {
     unsigned int offset;
@@ -1242,6 +2049,31 @@ int modbus_reply_exception(modbus_t *ctx, const uint8_t *req, unsigned int excep
     }
 }
 
+/* Sets the nb bits of dest from the rc bytes of IO status of the response */
+static void
+decode_io_status(modbus_t *ctx, const uint8_t *rsp, int rc, int nb, uint8_t *dest)
+{
+    unsigned int offset = ctx->backend->header_length + 2;
+
+    /* The response can't hold more than rc * 8 bits */
+    if (nb > rc * 8)
+        nb = rc * 8;
+
+    _modbus_unpack_bits(dest, rsp + offset, nb);
+}
+
+/* Sets the rc registers of dest from the response */
+static void decode_registers(modbus_t *ctx, const uint8_t *rsp, int rc, uint16_t *dest)
+{
+    unsigned int offset = ctx->backend->header_length;
+    int i;
+
+    for (i = 0; i < rc; i++) {
+        /* shift reg hi_byte to temp OR with lo_byte */
+        dest[i] = (rsp[offset + 2 + (i << 1)] << 8) | rsp[offset + 3 + (i << 1)];
+    }
+}
+
 /* Reads IO status */
 static int read_io_status(modbus_t *ctx, int function, int addr, int nb, uint8_t *dest)
 {
@@ -1255,12 +2087,6 @@ static int read_io_status(modbus_t *ctx, int function, int addr, int nb, uint8_t
 
     rc = send_msg(ctx, req, req_length);
     if (rc > 0) {
-        int temp, bit;
-        int pos = 0;
-        unsigned int offset;
-        unsigned int offset_end;
-        unsigned int i;
-
         rc = _modbus_receive_msg(ctx, rsp, MSG_CONFIRMATION);
         if (rc == -1)
             return -1;
@@ -1269,17 +2095,7 @@ static int read_io_status(modbus_t *ctx, int function, int addr, int nb, uint8_t
         if (rc == -1)
             return -1;
 
-        offset = ctx->backend->header_length + 2;
-        offset_end = offset + rc;
-        for (i = offset; i < offset_end; i++) {
-            /* Shift reg hi_byte to temp */
-            temp = rsp[i];
-
-            for (bit = 0x01; (bit & 0xff) && (pos < nb);) {
-                dest[pos++] = (temp & bit) ? TRUE : FALSE;
-                bit = bit << 1;
-            }
-        }
+        decode_io_status(ctx, rsp, rc, nb, dest);
     }
 
     return rc;
@@ -1344,8 +2160,10 @@ int modbus_read_input_bits(modbus_t *ctx, int addr, int nb, uint8_t *dest)
         return nb;
 }
 
-/* Reads the data from a remote device and put that data into an array */
-static int read_registers(modbus_t *ctx, int function, int addr, int nb, uint16_t *dest)
+/* Reads the data from a remote device and put that data into an array, the
+   registers are copied as received (big-endian) when raw is set */
+static int read_registers(
+    modbus_t *ctx, int function, int addr, int nb, uint16_t *dest, int raw)
 {
     int rc;
     int req_length;
@@ -1367,9 +2185,6 @@ static int read_registers(modbus_t *ctx, int function, int addr, int nb, uint16_
 
     rc = send_msg(ctx, req, req_length);
     if (rc > 0) {
-        unsigned int offset;
-        int i;
-
         rc = _modbus_receive_msg(ctx, rsp, MSG_CONFIRMATION);
         if (rc == -1)
             return -1;
@@ -1378,12 +2193,10 @@ static int read_registers(modbus_t *ctx, int function, int addr, int nb, uint16_
         if (rc == -1)
             return -1;
 
-        offset = ctx->backend->header_length;
-
-        for (i = 0; i < rc; i++) {
-            /* shift reg hi_byte to temp OR with lo_byte */
-            dest[i] = (rsp[offset + 2 + (i << 1)] << 8) | rsp[offset + 3 + (i << 1)];
-        }
+        if (raw)
+            memcpy(dest, rsp + ctx->backend->header_length + 2, rc * 2);
+        else
+            decode_registers(ctx, rsp, rc, dest);
     }
 
     return rc;
@@ -1411,10 +2224,33 @@ int modbus_read_registers(modbus_t *ctx, int addr, int nb, uint16_t *dest)
         return -1;
     }
 
-    status = read_registers(ctx, MODBUS_FC_READ_HOLDING_REGISTERS, addr, nb, dest);
+    status = read_registers(ctx, MODBUS_FC_READ_HOLDING_REGISTERS, addr, nb, dest, FALSE);
     return status;
 }
 
+/* Same as modbus_read_registers but the registers are copied in the byte order
+   of the response (big-endian) without any conversion */
+int modbus_read_registers_raw(modbus_t *ctx, int addr, int nb, uint16_t *dest)
+{
+    if (ctx == NULL || dest == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (nb < 1 || nb > MODBUS_MAX_READ_REGISTERS) {
+        if (ctx->debug) {
+            fprintf(stderr,
+                    "ERROR Too many registers requested (%d > %d)\n",
+                    nb,
+                    MODBUS_MAX_READ_REGISTERS);
+        }
+        errno = EMBXILVAL;
+        return -1;
+    }
+
+    return read_registers(ctx, MODBUS_FC_READ_HOLDING_REGISTERS, addr, nb, dest, TRUE);
+}
+
 /* Reads the input registers of remote device and put the data into an array */
 int modbus_read_input_registers(modbus_t *ctx, int addr, int nb, uint16_t *dest)
 {
@@ -1436,11 +2272,33 @@ int modbus_read_input_registers(modbus_t *ctx, int addr, int nb, uint16_t *dest)
         return -1;
     }
 
-    status = read_registers(ctx, MODBUS_FC_READ_INPUT_REGISTERS, addr, nb, dest);
+    status = read_registers(ctx, MODBUS_FC_READ_INPUT_REGISTERS, addr, nb, dest, FALSE);
 
     return status;
 }
 
+/* Same as modbus_read_input_registers but without conversion of the registers */
+int modbus_read_input_registers_raw(modbus_t *ctx, int addr, int nb, uint16_t *dest)
+{
+    if (ctx == NULL || dest == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (nb < 1 || nb > MODBUS_MAX_READ_REGISTERS) {
+        if (ctx->debug) {
+            fprintf(stderr,
+                    "ERROR Too many input registers requested (%d > %d)\n",
+                    nb,
+                    MODBUS_MAX_READ_REGISTERS);
+        }
+        errno = EMBXILVAL;
+        return -1;
+    }
+
+    return read_registers(ctx, MODBUS_FC_READ_INPUT_REGISTERS, addr, nb, dest, TRUE);
+}
+
 /* Write a value to the specified register of the remote device.
    Used by write_bit and write_register */
 static int write_single(modbus_t *ctx, int function, int addr, const uint16_t value)
@@ -1493,15 +2351,28 @@ int modbus_write_register(modbus_t *ctx, int addr, const uint16_t value)
     return write_single(ctx, MODBUS_FC_WRITE_SINGLE_REGISTER, addr, value);
 }
 
+/* Builds the request to write the bits of the array */
+static int build_write_bits_request(
+    modbus_t *ctx, int addr, int nb, const uint8_t *src, uint8_t *req)
+{
+    int byte_count;
+    int req_length;
+
+    req_length = ctx->backend->build_request_basis(
+        ctx, MODBUS_FC_WRITE_MULTIPLE_COILS, addr, nb, req);
+    byte_count = (nb / 8) + ((nb % 8) ? 1 : 0);
+    req[req_length++] = byte_count;
+
+    _modbus_pack_bits(req + req_length, src, nb);
+
+    return req_length + byte_count;
+}
+
 /* Write the bits of the array in the remote device */
 int modbus_write_bits(modbus_t *ctx, int addr, int nb, const uint8_t *src)
 {
     int rc;
-    int i;
-    int byte_count;
     int req_length;
-    int bit_check = 0;
-    int pos = 0;
     uint8_t req[MAX_MESSAGE_LENGTH];
 
     if (ctx == NULL || src == NULL) {
@@ -1520,31 +2391,11 @@ int modbus_write_bits(modbus_t *ctx, int addr, int nb, const uint8_t *src)
         return -1;
     }
 
-    req_length = ctx->backend->build_request_basis(
-        ctx, MODBUS_FC_WRITE_MULTIPLE_COILS, addr, nb, req);
-    byte_count = (nb / 8) + ((nb % 8) ? 1 : 0);
-    req[req_length++] = byte_count;
+    req_length = build_write_bits_request(ctx, addr, nb, src, req);
 
-    for (i = 0; i < byte_count; i++) {
-        int bit;
-
-        bit = 0x01;
-        req[req_length] = 0;
-
-        while ((bit & 0xFF) && (bit_check++ < nb)) {
-            if (src[pos++])
-                req[req_length] |= bit;
-            else
-                req[req_length] &= ~bit;
-
-            bit = bit << 1;
-        }
-        req_length++;
-    }
-
-    rc = send_msg(ctx, req, req_length);
-    if (rc > 0) {
-        uint8_t rsp[MAX_MESSAGE_LENGTH];
+    rc = send_msg(ctx, req, req_length);
+    if (rc > 0) {
+        uint8_t rsp[MAX_MESSAGE_LENGTH];
 
         rc = _modbus_receive_msg(ctx, rsp, MSG_CONFIRMATION);
         if (rc == -1)
@@ -1556,13 +2407,32 @@ int modbus_write_bits(modbus_t *ctx, int addr, int nb, const uint8_t *src)
     return rc;
 }
 
+/* Builds the request to write the values of the array to the registers */
+static int build_write_registers_request(
+    modbus_t *ctx, int addr, int nb, const uint16_t *src, uint8_t *req)
+{
+    int i;
+    int req_length;
+    int byte_count;
+
+    req_length = ctx->backend->build_request_basis(
+        ctx, MODBUS_FC_WRITE_MULTIPLE_REGISTERS, addr, nb, req);
+    byte_count = nb * 2;
+    req[req_length++] = byte_count;
+
+    for (i = 0; i < nb; i++) {
+        req[req_length++] = src[i] >> 8;
+        req[req_length++] = src[i] & 0x00FF;
+    }
+
+    return req_length;
+}
+
 /* Write the values from the array to the registers of the remote device */
 int modbus_write_registers(modbus_t *ctx, int addr, int nb, const uint16_t *src)
 {
     int rc;
-    int i;
     int req_length;
-    int byte_count;
     uint8_t req[MAX_MESSAGE_LENGTH];
 
     if (ctx == NULL || src == NULL) {
@@ -1581,15 +2451,7 @@ int modbus_write_registers(modbus_t *ctx, int addr, int nb, const uint16_t *src)
         return -1;
     }
 
-    req_length = ctx->backend->build_request_basis(
-        ctx, MODBUS_FC_WRITE_MULTIPLE_REGISTERS, addr, nb, req);
-    byte_count = nb * 2;
-    req[req_length++] = byte_count;
-
-    for (i = 0; i < nb; i++) {
-        req[req_length++] = src[i] >> 8;
-        req[req_length++] = src[i] & 0x00FF;
-    }
+    req_length = build_write_registers_request(ctx, addr, nb, src, req);
 
     rc = send_msg(ctx, req, req_length);
     if (rc > 0) {
@@ -1690,83 +2552,596 @@ int modbus_write_and_read_registers(modbus_t *ctx,
     req_length = ctx->backend->build_request_basis(
         ctx, MODBUS_FC_WRITE_AND_READ_REGISTERS, read_addr, read_nb, req);
 
-    req[req_length++] = write_addr >> 8;
-    req[req_length++] = write_addr & 0x00ff;
-    req[req_length++] = write_nb >> 8;
-    req[req_length++] = write_nb & 0x00ff;
-    byte_count = write_nb * 2;
-    req[req_length++] = byte_count;
+    req[req_length++] = write_addr >> 8;
+    req[req_length++] = write_addr & 0x00ff;
+    req[req_length++] = write_nb >> 8;
+    req[req_length++] = write_nb & 0x00ff;
+    byte_count = write_nb * 2;
+    req[req_length++] = byte_count;
+
+    for (i = 0; i < write_nb; i++) {
+        req[req_length++] = src[i] >> 8;
+        req[req_length++] = src[i] & 0x00FF;
+    }
+
+    rc = send_msg(ctx, req, req_length);
+    if (rc > 0) {
+        rc = _modbus_receive_msg(ctx, rsp, MSG_CONFIRMATION);
+        if (rc == -1)
+            return -1;
+
+        rc = check_confirmation(ctx, req, rsp, rc);
+        if (rc == -1)
+            return -1;
+
+        decode_registers(ctx, rsp, rc, dest);
+    }
+
+    return rc;
+}
+
+/* Send a request to get the slave ID of the device (only available in serial
+   communication). */
+int modbus_report_slave_id(modbus_t *ctx, int max_dest, uint8_t *dest)
+{
+    int rc;
+    int req_length;
+    uint8_t req[_MIN_REQ_LENGTH];
+
+    if (ctx == NULL || max_dest <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    req_length =
+        ctx->backend->build_request_basis(ctx, MODBUS_FC_REPORT_SLAVE_ID, 0, 0, req);
+
+    /* HACKISH, addr and count are not used */
+    req_length -= 4;
+
+    rc = send_msg(ctx, req, req_length);
+    if (rc > 0) {
+        int i;
+        unsigned int offset;
+        uint8_t rsp[MAX_MESSAGE_LENGTH];
+
+        rc = _modbus_receive_msg(ctx, rsp, MSG_CONFIRMATION);
+        if (rc == -1)
+            return -1;
+
+        rc = check_confirmation(ctx, req, rsp, rc);
+        if (rc == -1)
+            return -1;
+
+        offset = ctx->backend->header_length + 2;
+
+        /* Byte count, slave id, run indicator status and
+           additional data. Truncate copy to max_dest. */
+        for (i = 0; i < rc && i < max_dest; i++) {
+            dest[i] = rsp[offset + i];
+        }
+    }
+
+    return rc;
+}
+
+/*
+ * Pipelined transactions
+ *
+ * The modbus_send_* functions send a request without waiting for its
+ * confirmation so many requests can be in flight on the same connection. The
+ * confirmations are matched to their requests with the transaction ID of the
+ * response by modbus_receive_completion().
+ */
+
+/* Sends the request and registers it as a pending transaction. Returns the
+   transaction ID of the request. */
+static int send_pending(modbus_t *ctx, uint8_t *req, int req_length, int nb, void *dest)
+{
+    int rc;
+    modbus_pending_t *pending;
+
+    rc = send_msg(ctx, req, req_length);
+    if (rc == -1)
+        return -1;
+
+    pending = &ctx->pending[ctx->nb_pending++];
+    pending->tid = ctx->backend->get_response_tid(req);
+    pending->nb = nb;
+    pending->dest = dest;
+    memcpy(pending->req, req, _MIN_REQ_LENGTH);
+    _modbus_get_time(&pending->deadline);
+    _timeval_add(&pending->deadline, &ctx->response_timeout);
+
+    return pending->tid;
+}
+
+/* Checks there is a free slot to send a new request */
+static int check_pending_slot(modbus_t *ctx)
+{
+    if (ctx->pending == NULL) {
+        ctx->pending =
+            (modbus_pending_t *) malloc(ctx->max_pending * sizeof(modbus_pending_t));
+        if (ctx->pending == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+
+    if (ctx->nb_pending >= ctx->max_pending) {
+        if (ctx->debug) {
+            fprintf(stderr,
+                    "ERROR Too many pending requests (%d)\n",
+                    ctx->max_pending);
+        }
+        errno = EBUSY;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int send_read_request(modbus_t *ctx, int function, int addr, int nb, void *dest)
+{
+    int req_length;
+    uint8_t req[_MIN_REQ_LENGTH];
+
+    if (check_pending_slot(ctx) == -1)
+        return -1;
+
+    req_length = ctx->backend->build_request_basis(ctx, function, addr, nb, req);
+
+    return send_pending(ctx, req, req_length, nb, dest);
+}
+
+/* Sends a request to read bits without waiting for the confirmation */
+int modbus_send_read_bits(modbus_t *ctx, int addr, int nb, uint8_t *dest)
+{
+    if (ctx == NULL || dest == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (nb < 1 || nb > MODBUS_MAX_READ_BITS) {
+        if (ctx->debug) {
+            fprintf(stderr,
+                    "ERROR Too many bits requested (%d > %d)\n",
+                    nb,
+                    MODBUS_MAX_READ_BITS);
+        }
+        errno = EMBXILVAL;
+        return -1;
+    }
+
+    return send_read_request(ctx, MODBUS_FC_READ_COILS, addr, nb, dest);
+}
+
+/* Same as modbus_send_read_bits but reads the remote device input table */
+int modbus_send_read_input_bits(modbus_t *ctx, int addr, int nb, uint8_t *dest)
+{
+    if (ctx == NULL || dest == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (nb < 1 || nb > MODBUS_MAX_READ_BITS) {
+        if (ctx->debug) {
+            fprintf(stderr,
+                    "ERROR Too many discrete inputs requested (%d > %d)\n",
+                    nb,
+                    MODBUS_MAX_READ_BITS);
+        }
+        errno = EMBXILVAL;
+        return -1;
+    }
+
+    return send_read_request(ctx, MODBUS_FC_READ_DISCRETE_INPUTS, addr, nb, dest);
+}
+
+/* Sends a request to read the holding registers without waiting for the
+   confirmation */
+int modbus_send_read_registers(modbus_t *ctx, int addr, int nb, uint16_t *dest)
+{
+    if (ctx == NULL || dest == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (nb < 1 || nb > MODBUS_MAX_READ_REGISTERS) {
+        if (ctx->debug) {
+            fprintf(stderr,
+                    "ERROR Too many registers requested (%d > %d)\n",
+                    nb,
+                    MODBUS_MAX_READ_REGISTERS);
+        }
+        errno = EMBXILVAL;
+        return -1;
+    }
+
+    return send_read_request(ctx, MODBUS_FC_READ_HOLDING_REGISTERS, addr, nb, dest);
+}
+
+/* Same as modbus_send_read_registers but reads the input registers */
+int modbus_send_read_input_registers(modbus_t *ctx, int addr, int nb, uint16_t *dest)
+{
+    if (ctx == NULL || dest == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (nb < 1 || nb > MODBUS_MAX_READ_REGISTERS) {
+        if (ctx->debug) {
+            fprintf(stderr,
+                    "ERROR Too many input registers requested (%d > %d)\n",
+                    nb,
+                    MODBUS_MAX_READ_REGISTERS);
+        }
+        errno = EMBXILVAL;
+        return -1;
+    }
+
+    return send_read_request(ctx, MODBUS_FC_READ_INPUT_REGISTERS, addr, nb, dest);
+}
+
+/* Sends a request to turn ON or OFF a single bit */
+int modbus_send_write_bit(modbus_t *ctx, int addr, int status)
+{
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return send_read_request(
+        ctx, MODBUS_FC_WRITE_SINGLE_COIL, addr, status ? 0xFF00 : 0, NULL);
+}
+
+/* Sends a request to write a value in one register */
+int modbus_send_write_register(modbus_t *ctx, int addr, const uint16_t value)
+{
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return send_read_request(ctx, MODBUS_FC_WRITE_SINGLE_REGISTER, addr, value, NULL);
+}
+
+/* Sends a request to write the bits of the array */
+int modbus_send_write_bits(modbus_t *ctx, int addr, int nb, const uint8_t *src)
+{
+    int req_length;
+    uint8_t req[MAX_MESSAGE_LENGTH];
+
+    if (ctx == NULL || src == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (nb < 1 || nb > MODBUS_MAX_WRITE_BITS) {
+        if (ctx->debug) {
+            fprintf(stderr,
+                    "ERROR Writing too many bits (%d > %d)\n",
+                    nb,
+                    MODBUS_MAX_WRITE_BITS);
+        }
+        errno = EMBXILVAL;
+        return -1;
+    }
+
+    if (check_pending_slot(ctx) == -1)
+        return -1;
+
+    req_length = build_write_bits_request(ctx, addr, nb, src, req);
+
+    return send_pending(ctx, req, req_length, nb, NULL);
+}
+
+/* Sends a request to write the values of the array to the registers */
+int modbus_send_write_registers(modbus_t *ctx, int addr, int nb, const uint16_t *src)
+{
+    int req_length;
+    uint8_t req[MAX_MESSAGE_LENGTH];
+
+    if (ctx == NULL || src == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (nb < 1 || nb > MODBUS_MAX_WRITE_REGISTERS) {
+        if (ctx->debug) {
+            fprintf(stderr,
+                    "ERROR Trying to write to too many registers (%d > %d)\n",
+                    nb,
+                    MODBUS_MAX_WRITE_REGISTERS);
+        }
+        errno = EMBXILVAL;
+        return -1;
+    }
+
+    if (check_pending_slot(ctx) == -1)
+        return -1;
+
+    req_length = build_write_registers_request(ctx, addr, nb, src, req);
+
+    return send_pending(ctx, req, req_length, nb, NULL);
+}
+
+/* Returns the pending transaction with the closest deadline */
+static modbus_pending_t *first_pending(modbus_t *ctx)
+{
+    modbus_pending_t *first = &ctx->pending[0];
+    int i;
+
+    for (i = 1; i < ctx->nb_pending; i++) {
+        if (_timeval_cmp(&ctx->pending[i].deadline, &first->deadline) < 0) {
+            first = &ctx->pending[i];
+        }
+    }
+
+    return first;
+}
+
+/* Removes the transaction from the pending ones and stores it in done */
+static void
+remove_pending(modbus_t *ctx, modbus_pending_t *pending, modbus_pending_t *done)
+{
+    *done = *pending;
+    *pending = ctx->pending[--ctx->nb_pending];
+}
+
+/* Completes the oldest transaction with ETIMEDOUT if its deadline is reached.
+   Otherwise returns 0 and stores the remaining time in tv. */
+static int expire_pending(modbus_t *ctx, int *tid, struct timeval *tv)
+{
+    struct timeval now;
+    modbus_pending_t *pending = first_pending(ctx);
+    modbus_pending_t done;
+
+    _modbus_get_time(&now);
+    if (_timeval_cmp(&pending->deadline, &now) > 0) {
+        if (tv != NULL)
+            _timeval_sub(tv, &pending->deadline, &now);
+        return 0;
+    }
+
+    remove_pending(ctx, pending, &done);
+    *tid = done.tid;
+    if (ctx->debug) {
+        fprintf(stderr, "ERROR Transaction %d timed out\n", done.tid);
+    }
+    errno = ETIMEDOUT;
+    return -1;
+}
+
+/* Completes the pending transaction of the confirmation.
+
+   Returns 0 when the confirmation doesn't match any pending transaction,
+   otherwise the result of the transaction is returned as described in
+   modbus_receive_completion. */
+static int complete_pending(modbus_t *ctx, uint8_t *rsp, int rsp_length, int *tid)
+{
+    int rc;
+    int i;
+    int function;
+    int rsp_tid = ctx->backend->get_response_tid(rsp);
+    modbus_pending_t done;
+
+    for (i = 0; i < ctx->nb_pending; i++) {
+        if (ctx->pending[i].tid == rsp_tid)
+            break;
+    }
+
+    if (i == ctx->nb_pending) {
+        /* Late response of an expired transaction */
+        if (ctx->debug) {
+            fprintf(
+                stderr, "Confirmation of unknown transaction ID 0x%X ignored\n", rsp_tid);
+        }
+        return 0;
+    }
+
+    remove_pending(ctx, &ctx->pending[i], &done);
+    *tid = done.tid;
+
+    rc = check_confirmation(ctx, done.req, rsp, rsp_length);
+    if (rc == -1)
+        return -1;
+
+    function = done.req[ctx->backend->header_length];
+    switch (function) {
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE_INPUTS:
+        decode_io_status(ctx, rsp, rc, done.nb, done.dest);
+        rc = done.nb;
+        break;
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
+    case MODBUS_FC_READ_INPUT_REGISTERS:
+        decode_registers(ctx, rsp, rc, done.dest);
+        break;
+    default:
+        break;
+    }
+
+    return rc;
+}
+
+/* Waits for the confirmation of one of the pending transactions.
+
+   The function shall return the same value than the blocking function
+   associated to the request (eg. the number of read registers) and store the
+   transaction ID of the completed request in tid. Otherwise it shall return -1
+   and set errno, tid is set to -1 when the error isn't related to a pending
+   transaction.
+*/
+int modbus_receive_completion(modbus_t *ctx, int *tid)
+{
+    int rc;
+    uint8_t rsp[MAX_MESSAGE_LENGTH];
+
+    if (ctx == NULL || tid == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *tid = -1;
+
+    if (ctx->nb_pending == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (;;) {
+        struct timeval tv;
+
+        if (expire_pending(ctx, tid, &tv) == -1)
+            return -1;
+
+        rc = receive_msg(ctx, rsp, MSG_CONFIRMATION, &tv);
+        if (rc == -1) {
+            if (errno == ETIMEDOUT && ctx->nb_pending > 0)
+                continue;
+            return -1;
+        }
+
+        /* Ignored message (sent to another slave) */
+        if (rc == 0)
+            continue;
+
+        rc = complete_pending(ctx, rsp, rc, tid);
+        if (rc != 0)
+            return rc;
+    }
+}
+
+/* Completes a pending transaction without blocking.
+
+   The function reads the available data of the connection, so it should be
+   called when the socket returned by modbus_get_socket is readable or when the
+   delay returned by modbus_get_pending_timeout expires. A partially received
+   confirmation is kept in the context until the next call.
+
+   The function shall return the same value as modbus_receive_completion.
+   When no transaction is completed, it shall return -1 and set errno to
+   EAGAIN.
+*/
+int modbus_poll_completion(modbus_t *ctx, int *tid)
+{
+    int rc;
+    uint8_t rsp[MAX_MESSAGE_LENGTH];
+
+    if (ctx == NULL || tid == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *tid = -1;
 
-    for (i = 0; i < write_nb; i++) {
-        req[req_length++] = src[i] >> 8;
-        req[req_length++] = src[i] & 0x00FF;
+    if (ctx->nb_pending == 0) {
+        errno = EINVAL;
+        return -1;
     }
 
-    rc = send_msg(ctx, req, req_length);
-    if (rc > 0) {
-        unsigned int offset;
+    if (!ctx->backend->is_connected(ctx)) {
+        if (ctx->debug) {
+            fprintf(stderr, "ERROR The connection is not established.\n");
+        }
+        return -1;
+    }
 
-        rc = _modbus_receive_msg(ctx, rsp, MSG_CONFIRMATION);
-        if (rc == -1)
+    for (;;) {
+        rc = _modbus_poll_msg(ctx, rsp, MSG_CONFIRMATION);
+        if (rc == -1) {
+            if (errno == EAGAIN) {
+                if (expire_pending(ctx, tid, NULL) == -1)
+                    return -1;
+                errno = EAGAIN;
+            }
             return -1;
+        }
 
-        rc = check_confirmation(ctx, req, rsp, rc);
-        if (rc == -1)
-            return -1;
+        /* Ignored message (sent to another slave) */
+        if (rc == 0)
+            continue;
 
-        offset = ctx->backend->header_length;
-        for (i = 0; i < rc; i++) {
-            /* shift reg hi_byte to temp OR with lo_byte */
-            dest[i] = (rsp[offset + 2 + (i << 1)] << 8) | rsp[offset + 3 + (i << 1)];
-        }
+        rc = complete_pending(ctx, rsp, rc, tid);
+        if (rc != 0)
+            return rc;
     }
-
-    return rc;
 }
 
-/* Send a request to get the slave ID of the device (only available in serial
-   communication). */
-int modbus_report_slave_id(modbus_t *ctx, int max_dest, uint8_t *dest)
+/* Stores the delay before the expiration of the oldest pending transaction in
+   to_sec and to_usec. The delay is zero when the transaction has already
+   expired. */
+int modbus_get_pending_timeout(modbus_t *ctx, uint32_t *to_sec, uint32_t *to_usec)
 {
-    int rc;
-    int req_length;
-    uint8_t req[_MIN_REQ_LENGTH];
+    struct timeval now;
+    struct timeval tv;
+    modbus_pending_t *pending;
 
-    if (ctx == NULL || max_dest <= 0) {
+    if (ctx == NULL || ctx->nb_pending == 0) {
         errno = EINVAL;
         return -1;
     }
 
-    req_length =
-        ctx->backend->build_request_basis(ctx, MODBUS_FC_REPORT_SLAVE_ID, 0, 0, req);
+    pending = first_pending(ctx);
+    _modbus_get_time(&now);
+    if (_timeval_cmp(&pending->deadline, &now) > 0) {
+        _timeval_sub(&tv, &pending->deadline, &now);
+    } else {
+        tv.tv_sec = 0;
+        tv.tv_usec = 0;
+    }
 
-    /* HACKISH, addr and count are not used */
-    req_length -= 4;
+    *to_sec = tv.tv_sec;
+    *to_usec = tv.tv_usec;
+    return 0;
+}
 
-    rc = send_msg(ctx, req, req_length);
-    if (rc > 0) {
-        int i;
-        unsigned int offset;
-        uint8_t rsp[MAX_MESSAGE_LENGTH];
+/* Defines the number of transactions which can be sent by the modbus_send_*
+   functions before receiving their confirmations. */
+int modbus_set_max_pending(modbus_t *ctx, int max_pending)
+{
+    if (ctx == NULL || max_pending < 1 || max_pending > UINT16_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
 
-        rc = _modbus_receive_msg(ctx, rsp, MSG_CONFIRMATION);
-        if (rc == -1)
-            return -1;
+    /* There is no transaction ID to match the confirmations in RTU */
+    if (ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_TCP && max_pending > 1) {
+        errno = EINVAL;
+        return -1;
+    }
 
-        rc = check_confirmation(ctx, req, rsp, rc);
-        if (rc == -1)
-            return -1;
+    if (ctx->nb_pending > 0) {
+        errno = EBUSY;
+        return -1;
+    }
 
-        offset = ctx->backend->header_length + 2;
+    free(ctx->pending);
+    ctx->pending = NULL;
+    ctx->max_pending = max_pending;
+    return 0;
+}
 
-        /* Byte count, slave id, run indicator status and
-           additional data. Truncate copy to max_dest. */
-        for (i = 0; i < rc && i < max_dest; i++) {
-            dest[i] = rsp[offset + i];
-        }
+int modbus_get_max_pending(modbus_t *ctx)
+{
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
     }
 
-    return rc;
+    return ctx->max_pending;
+}
+
+/* Returns the number of transactions waiting for their confirmation */
+int modbus_get_nb_pending(modbus_t *ctx)
+{
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return ctx->nb_pending;
 }
 
 void _modbus_init_common(modbus_t *ctx)
@@ -1787,6 +3162,18 @@ void _modbus_init_common(modbus_t *ctx)
 
     ctx->indication_timeout.tv_sec = 0;
     ctx->indication_timeout.tv_usec = 0;
+
+    ctx->pending = NULL;
+    ctx->nb_pending = 0;
+    ctx->max_pending = 1;
+    clear_rx_buffer(ctx);
+    ctx->rx_silence.tv_sec = 0;
+    ctx->rx_silence.tv_usec = 0;
+    ctx->indication_read_ahead = FALSE;
+    ctx->event_driven = FALSE;
+    ctx->reply_handlers = NULL;
+    ctx->handler_call = NULL;
+    ctx->server_conn = NULL;
 }
 
 /* Define the slave number */
@@ -1972,6 +3359,9 @@ void modbus_close(modbus_t *ctx)
         return;
 
     ctx->backend->close(ctx);
+    /* The confirmations of the pending transactions are lost */
+    ctx->nb_pending = 0;
+    clear_rx_buffer(ctx);
 }
 
 void modbus_free(modbus_t *ctx)
@@ -1979,6 +3369,8 @@ void modbus_free(modbus_t *ctx)
     if (ctx == NULL)
         return;
 
+    free(ctx->pending);
+    free(ctx->reply_handlers);
     ctx->backend->free(ctx);
 }
 
@@ -1993,28 +3385,58 @@ int modbus_set_debug(modbus_t *ctx, int flag)
     return 0;
 }
 
-/* Allocates 4 arrays to store bits, input bits, registers and inputs
-   registers. The pointers are stored in modbus_mapping structure.
-
-   The modbus_mapping_new_start_address() function shall return the new allocated
-   structure if successful. Otherwise it shall return NULL and set errno to
-   ENOMEM. */
-modbus_mapping_t *modbus_mapping_new_start_address(unsigned int start_bits,
-                                                   unsigned int nb_bits,
-                                                   unsigned int start_input_bits,
-                                                   unsigned int nb_input_bits,
-                                                   unsigned int start_registers,
-                                                   unsigned int nb_registers,
-                                                   unsigned int start_input_registers,
-                                                   unsigned int nb_input_registers)
+/* Allocates the mapping with the options of flags (modbus_mapping_flags): the
+   bits packed 8 per byte, the registers in wire order or the tables guarded by
+   a sequence lock. Returns NULL and sets errno to EINVAL on an unknown flag,
+   ENOTSUP if the sequence lock isn't available or ENOMEM. */
+modbus_mapping_t *modbus_mapping_new_ext(unsigned int start_bits,
+                                         unsigned int nb_bits,
+                                         unsigned int start_input_bits,
+                                         unsigned int nb_input_bits,
+                                         unsigned int start_registers,
+                                         unsigned int nb_registers,
+                                         unsigned int start_input_registers,
+                                         unsigned int nb_input_registers,
+                                         unsigned int flags)
 {
     modbus_mapping_t *mb_mapping;
+    unsigned int size_bits = nb_bits;
+    unsigned int size_input_bits = nb_input_bits;
+
+    if (flags & ~((unsigned int) (MODBUS_MAPPING_SYNC | MODBUS_MAPPING_PACKED_BITS |
+                                  MODBUS_MAPPING_WIRE_ORDER))) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (flags & MODBUS_MAPPING_PACKED_BITS) {
+        size_bits = (nb_bits / 8) + ((nb_bits % 8) ? 1 : 0);
+        size_input_bits = (nb_input_bits / 8) + ((nb_input_bits % 8) ? 1 : 0);
+    }
+
+#ifndef _MODBUS_HAVE_ATOMICS
+    if (flags & MODBUS_MAPPING_SYNC) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+#endif
 
     mb_mapping = (modbus_mapping_t *) malloc(sizeof(modbus_mapping_t));
     if (mb_mapping == NULL) {
         return NULL;
     }
 
+    mb_mapping->flags = flags;
+    if (flags == MODBUS_MAPPING_DEFAULT) {
+        mb_mapping->ext = NULL;
+    } else {
+        mb_mapping->ext = calloc(1, sizeof(modbus_mapping_ext_t));
+        if (mb_mapping->ext == NULL) {
+            free(mb_mapping);
+            return NULL;
+        }
+    }
+
     /* 0X */
     mb_mapping->nb_bits = nb_bits;
     mb_mapping->start_bits = start_bits;
@@ -2022,12 +3444,13 @@ modbus_mapping_t *modbus_mapping_new_start_address(unsigned int start_bits,
         mb_mapping->tab_bits = NULL;
     } else {
         /* Negative number raises a POSIX error */
-        mb_mapping->tab_bits = (uint8_t *) malloc(nb_bits * sizeof(uint8_t));
+        mb_mapping->tab_bits = (uint8_t *) malloc(size_bits * sizeof(uint8_t));
         if (mb_mapping->tab_bits == NULL) {
+            free(mb_mapping->ext);
             free(mb_mapping);
             return NULL;
         }
-        memset(mb_mapping->tab_bits, 0, nb_bits * sizeof(uint8_t));
+        memset(mb_mapping->tab_bits, 0, size_bits * sizeof(uint8_t));
     }
 
     /* 1X */
@@ -2036,13 +3459,15 @@ modbus_mapping_t *modbus_mapping_new_start_address(unsigned int start_bits,
     if (nb_input_bits == 0) {
         mb_mapping->tab_input_bits = NULL;
     } else {
-        mb_mapping->tab_input_bits = (uint8_t *) malloc(nb_input_bits * sizeof(uint8_t));
+        mb_mapping->tab_input_bits =
+            (uint8_t *) malloc(size_input_bits * sizeof(uint8_t));
         if (mb_mapping->tab_input_bits == NULL) {
             free(mb_mapping->tab_bits);
+            free(mb_mapping->ext);
             free(mb_mapping);
             return NULL;
         }
-        memset(mb_mapping->tab_input_bits, 0, nb_input_bits * sizeof(uint8_t));
+        memset(mb_mapping->tab_input_bits, 0, size_input_bits * sizeof(uint8_t));
     }
 
     /* 4X */
@@ -2055,6 +3480,7 @@ modbus_mapping_t *modbus_mapping_new_start_address(unsigned int start_bits,
         if (mb_mapping->tab_registers == NULL) {
             free(mb_mapping->tab_input_bits);
             free(mb_mapping->tab_bits);
+            free(mb_mapping->ext);
             free(mb_mapping);
             return NULL;
         }
@@ -2073,6 +3499,7 @@ modbus_mapping_t *modbus_mapping_new_start_address(unsigned int start_bits,
             free(mb_mapping->tab_registers);
             free(mb_mapping->tab_input_bits);
             free(mb_mapping->tab_bits);
+            free(mb_mapping->ext);
             free(mb_mapping);
             return NULL;
         }
@@ -2082,6 +3509,192 @@ modbus_mapping_t *modbus_mapping_new_start_address(unsigned int start_bits,
     return mb_mapping;
 }
 
+static int compare_ranges(const void *a, const void *b)
+{
+    int start_a = ((const modbus_mapping_range_t *) a)->start;
+    int start_b = ((const modbus_mapping_range_t *) b)->start;
+
+    /* The ranges aren't validated yet, a subtraction could overflow */
+    return (start_a > start_b) - (start_a < start_b);
+}
+
+/* Sorts the ranges by address and merges the contiguous ones into segments.
+   Returns the number of values of the table or -1 if the ranges are invalid. */
+static int new_segments(const modbus_mapping_range_t *ranges,
+                        int nb_ranges,
+                        modbus_mapping_segment_t **segments,
+                        int *nb_segments)
+{
+    modbus_mapping_range_t *sorted;
+    int nb_values = 0;
+    int i;
+
+    *segments = NULL;
+    *nb_segments = 0;
+
+    if (nb_ranges < 0 || (nb_ranges > 0 && ranges == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (nb_ranges == 0)
+        return 0;
+
+    sorted = (modbus_mapping_range_t *) malloc(nb_ranges * sizeof(*sorted));
+    if (sorted == NULL)
+        return -1;
+    memcpy(sorted, ranges, nb_ranges * sizeof(*sorted));
+    qsort(sorted, nb_ranges, sizeof(*sorted), compare_ranges);
+
+    *segments = (modbus_mapping_segment_t *) malloc(nb_ranges * sizeof(**segments));
+    if (*segments == NULL) {
+        free(sorted);
+        return -1;
+    }
+
+    for (i = 0; i < nb_ranges; i++) {
+        modbus_mapping_segment_t *last =
+            (*nb_segments > 0) ? *segments + *nb_segments - 1 : NULL;
+
+        if (sorted[i].start < 0 || sorted[i].start > UINT16_MAX || sorted[i].nb < 1 ||
+            sorted[i].nb > UINT16_MAX + 1 - sorted[i].start ||
+            (last != NULL && sorted[i].start < last->start + last->nb)) {
+            /* Out of the address space or overlapping ranges */
+            free(sorted);
+            free(*segments);
+            *segments = NULL;
+            *nb_segments = 0;
+            errno = EINVAL;
+            return -1;
+        }
+
+        if (last != NULL && sorted[i].start == last->start + last->nb) {
+            last->nb += sorted[i].nb;
+        } else {
+            (*segments)[*nb_segments].start = sorted[i].start;
+            (*segments)[*nb_segments].nb = sorted[i].nb;
+            (*segments)[*nb_segments].index = nb_values;
+            (*nb_segments)++;
+        }
+        nb_values += sorted[i].nb;
+    }
+    free(sorted);
+
+    return nb_values;
+}
+
+/* Allocates a mapping made of many ranges of addresses per table, the values of
+   the ranges are stored one after the other, in address order, in the tab_xxx
+   arrays. */
+modbus_mapping_t *
+modbus_mapping_new_ranges(const modbus_mapping_range_t *bits_ranges,
+                          int nb_bits_ranges,
+                          const modbus_mapping_range_t *input_bits_ranges,
+                          int nb_input_bits_ranges,
+                          const modbus_mapping_range_t *registers_ranges,
+                          int nb_registers_ranges,
+                          const modbus_mapping_range_t *input_registers_ranges,
+                          int nb_input_registers_ranges,
+                          unsigned int flags)
+{
+    const modbus_mapping_range_t *ranges[4];
+    int nb_ranges[4];
+    modbus_mapping_segment_t *segments[4] = {NULL, NULL, NULL, NULL};
+    int nb_segments[4];
+    int nb_values[4];
+    modbus_mapping_t *mb_mapping;
+    modbus_mapping_ext_t *ext;
+    int table;
+
+    ranges[MODBUS_TABLE_BITS] = bits_ranges;
+    nb_ranges[MODBUS_TABLE_BITS] = nb_bits_ranges;
+    ranges[MODBUS_TABLE_INPUT_BITS] = input_bits_ranges;
+    nb_ranges[MODBUS_TABLE_INPUT_BITS] = nb_input_bits_ranges;
+    ranges[MODBUS_TABLE_REGISTERS] = registers_ranges;
+    nb_ranges[MODBUS_TABLE_REGISTERS] = nb_registers_ranges;
+    ranges[MODBUS_TABLE_INPUT_REGISTERS] = input_registers_ranges;
+    nb_ranges[MODBUS_TABLE_INPUT_REGISTERS] = nb_input_registers_ranges;
+
+    for (table = MODBUS_TABLE_BITS; table <= MODBUS_TABLE_INPUT_REGISTERS; table++) {
+        nb_values[table] = new_segments(
+            ranges[table], nb_ranges[table], &segments[table], &nb_segments[table]);
+        if (nb_values[table] == -1)
+            goto error;
+    }
+
+    mb_mapping = modbus_mapping_new_ext(0,
+                                        nb_values[MODBUS_TABLE_BITS],
+                                        0,
+                                        nb_values[MODBUS_TABLE_INPUT_BITS],
+                                        0,
+                                        nb_values[MODBUS_TABLE_REGISTERS],
+                                        0,
+                                        nb_values[MODBUS_TABLE_INPUT_REGISTERS],
+                                        flags & ~MODBUS_MAPPING_SEGMENTED);
+    if (mb_mapping == NULL)
+        goto error;
+
+    if (mb_mapping->ext == NULL) {
+        mb_mapping->ext = calloc(1, sizeof(modbus_mapping_ext_t));
+        if (mb_mapping->ext == NULL) {
+            modbus_mapping_free(mb_mapping);
+            goto error;
+        }
+    }
+
+    mb_mapping->flags |= MODBUS_MAPPING_SEGMENTED;
+    ext = (modbus_mapping_ext_t *) mb_mapping->ext;
+    for (table = MODBUS_TABLE_BITS; table <= MODBUS_TABLE_INPUT_REGISTERS; table++) {
+        ext->segments[table] = segments[table];
+        ext->nb_segments[table] = nb_segments[table];
+    }
+
+    /* Address of the first value of each table */
+    if (nb_segments[MODBUS_TABLE_BITS] > 0)
+        mb_mapping->start_bits = segments[MODBUS_TABLE_BITS][0].start;
+    if (nb_segments[MODBUS_TABLE_INPUT_BITS] > 0)
+        mb_mapping->start_input_bits = segments[MODBUS_TABLE_INPUT_BITS][0].start;
+    if (nb_segments[MODBUS_TABLE_REGISTERS] > 0)
+        mb_mapping->start_registers = segments[MODBUS_TABLE_REGISTERS][0].start;
+    if (nb_segments[MODBUS_TABLE_INPUT_REGISTERS] > 0)
+        mb_mapping->start_input_registers =
+            segments[MODBUS_TABLE_INPUT_REGISTERS][0].start;
+
+    return mb_mapping;
+
+error:
+    for (table = MODBUS_TABLE_BITS; table <= MODBUS_TABLE_INPUT_REGISTERS; table++) {
+        free(segments[table]);
+    }
+    return NULL;
+}
+
+/* Allocates 4 arrays to store bits, input bits, registers and inputs
+   registers. The pointers are stored in modbus_mapping structure.
+
+   The modbus_mapping_new_start_address() function shall return the new allocated
+   structure if successful. Otherwise it shall return NULL and set errno to
+   ENOMEM. */
+modbus_mapping_t *modbus_mapping_new_start_address(unsigned int start_bits,
+                                                   unsigned int nb_bits,
+                                                   unsigned int start_input_bits,
+                                                   unsigned int nb_input_bits,
+                                                   unsigned int start_registers,
+                                                   unsigned int nb_registers,
+                                                   unsigned int start_input_registers,
+                                                   unsigned int nb_input_registers)
+{
+    return modbus_mapping_new_ext(start_bits,
+                                  nb_bits,
+                                  start_input_bits,
+                                  nb_input_bits,
+                                  start_registers,
+                                  nb_registers,
+                                  start_input_registers,
+                                  nb_input_registers,
+                                  MODBUS_MAPPING_DEFAULT);
+}
+
 modbus_mapping_t *modbus_mapping_new(int nb_bits,
                                      int nb_input_bits,
                                      int nb_registers,
@@ -2098,13 +3711,186 @@ void modbus_mapping_free(modbus_mapping_t *mb_mapping)
         return;
     }
 
-    free(mb_mapping->tab_input_registers);
-    free(mb_mapping->tab_registers);
-    free(mb_mapping->tab_input_bits);
-    free(mb_mapping->tab_bits);
+    if (mb_mapping->flags & MODBUS_MAPPING_SHARED) {
+        /* The tables are in the region */
+        _modbus_mapping_unmap_shm((modbus_mapping_ext_t *) mb_mapping->ext);
+    } else {
+        free(mb_mapping->tab_input_registers);
+        free(mb_mapping->tab_registers);
+        free(mb_mapping->tab_input_bits);
+        free(mb_mapping->tab_bits);
+    }
+    if (mb_mapping->flags & MODBUS_MAPPING_SEGMENTED) {
+        modbus_mapping_ext_t *ext = (modbus_mapping_ext_t *) mb_mapping->ext;
+        int table;
+
+        for (table = MODBUS_TABLE_BITS; table <= MODBUS_TABLE_INPUT_REGISTERS; table++) {
+            free(ext->segments[table]);
+        }
+    }
+    free(mb_mapping->ext);
     free(mb_mapping);
 }
 
+/* Returns the index of the values at addr in the tab_xxx array of table or -1
+   if the nb values aren't in the mapping. */
+int modbus_mapping_get_index(const modbus_mapping_t *mb_mapping,
+                             modbus_table table,
+                             int addr,
+                             int nb)
+{
+    int idx;
+    int size;
+
+    if (mb_mapping == NULL || nb < 1 || table < MODBUS_TABLE_BITS ||
+        table > MODBUS_TABLE_INPUT_REGISTERS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    switch (table) {
+    case MODBUS_TABLE_BITS:
+        size = mb_mapping->nb_bits;
+        break;
+    case MODBUS_TABLE_INPUT_BITS:
+        size = mb_mapping->nb_input_bits;
+        break;
+    case MODBUS_TABLE_REGISTERS:
+        size = mb_mapping->nb_registers;
+        break;
+    default:
+        size = mb_mapping->nb_input_registers;
+        break;
+    }
+
+    idx = get_mapping_index(mb_mapping, table, addr, nb);
+    if (idx < 0 || idx + nb > size) {
+        errno = EMBXILADD;
+        return -1;
+    }
+
+    return idx;
+}
+
+/* Returns the value of tab_registers[idx] in the processor-endianness whatever
+   the storage order of the mapping */
+uint16_t modbus_mapping_get_register(const modbus_mapping_t *mb_mapping, int idx)
+{
+    return get_mapping_register(mb_mapping, mb_mapping->tab_registers, idx);
+}
+
+void modbus_mapping_set_register(modbus_mapping_t *mb_mapping, int idx, uint16_t value)
+{
+    set_mapping_register(mb_mapping, mb_mapping->tab_registers, idx, value);
+}
+
+uint16_t modbus_mapping_get_input_register(const modbus_mapping_t *mb_mapping, int idx)
+{
+    return get_mapping_register(mb_mapping, mb_mapping->tab_input_registers, idx);
+}
+
+void modbus_mapping_set_input_register(modbus_mapping_t *mb_mapping,
+                                       int idx,
+                                       uint16_t value)
+{
+    set_mapping_register(mb_mapping, mb_mapping->tab_input_registers, idx, value);
+}
+
+#ifdef _MODBUS_HAVE_ATOMICS
+/* Counter of the sequence lock, in the region of a shared mapping so the
+   processes are synchronized too */
+static unsigned int *get_mapping_seq(modbus_mapping_t *mb_mapping)
+{
+    modbus_mapping_ext_t *ext = (modbus_mapping_ext_t *) mb_mapping->ext;
+
+    if (ext->shm != NULL)
+        return &((modbus_mapping_shm_header_t *) ext->shm)->seq;
+
+    return &ext->seq;
+}
+#endif
+
+/* The writers of a synchronized mapping are serialized, the sequence counter
+   is made odd by the writer until the end of its update. */
+void modbus_mapping_write_begin(modbus_mapping_t *mb_mapping)
+{
+#ifdef _MODBUS_HAVE_ATOMICS
+    unsigned int *counter;
+    unsigned int seq;
+
+    if (mb_mapping == NULL || !(mb_mapping->flags & MODBUS_MAPPING_SYNC))
+        return;
+
+    counter = get_mapping_seq(mb_mapping);
+    for (;;) {
+        seq = __atomic_load_n(counter, __ATOMIC_RELAXED);
+        if ((seq & 1) == 0 &&
+            __atomic_compare_exchange_n(
+                counter, &seq, seq + 1, TRUE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+
+    /* The new values must not be visible before the odd counter */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+#else
+    (void) mb_mapping;
+#endif
+}
+
+void modbus_mapping_write_end(modbus_mapping_t *mb_mapping)
+{
+#ifdef _MODBUS_HAVE_ATOMICS
+    if (mb_mapping == NULL || !(mb_mapping->flags & MODBUS_MAPPING_SYNC))
+        return;
+
+    __atomic_fetch_add(get_mapping_seq(mb_mapping), 1, __ATOMIC_RELEASE);
+#else
+    (void) mb_mapping;
+#endif
+}
+
+/* Returns the sequence to give to modbus_mapping_read_retry once the values are
+   read, waits for the end of the current update if any. */
+unsigned int modbus_mapping_read_begin(modbus_mapping_t *mb_mapping)
+{
+#ifdef _MODBUS_HAVE_ATOMICS
+    unsigned int *counter;
+    unsigned int seq;
+
+    if (mb_mapping == NULL || !(mb_mapping->flags & MODBUS_MAPPING_SYNC))
+        return 0;
+
+    counter = get_mapping_seq(mb_mapping);
+    do {
+        seq = __atomic_load_n(counter, __ATOMIC_ACQUIRE);
+    } while (seq & 1);
+
+    return seq;
+#else
+    (void) mb_mapping;
+    return 0;
+#endif
+}
+
+/* Returns TRUE if the mapping has been modified since modbus_mapping_read_begin,
+   the values read in between must be read again. */
+int modbus_mapping_read_retry(modbus_mapping_t *mb_mapping, unsigned int seq)
+{
+#ifdef _MODBUS_HAVE_ATOMICS
+    if (mb_mapping == NULL || !(mb_mapping->flags & MODBUS_MAPPING_SYNC))
+        return FALSE;
+
+    /* The values must be read before the counter */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(get_mapping_seq(mb_mapping), __ATOMIC_RELAXED) != seq;
+#else
+    (void) mb_mapping;
+    (void) seq;
+    return FALSE;
+#endif
+}
+
 #ifndef HAVE_STRLCPY
 /*
  * Function strlcpy was originally developed by
@@ -173,8 +173,40 @@ typedef struct _modbus_mapping_t {
     uint8_t *tab_input_bits;
     uint16_t *tab_input_registers;
     uint16_t *tab_registers;
+    /* Options of modbus_mapping_new_ext (modbus_mapping_flags) */
+    unsigned int flags;
+    /* Internal data of the options */
+    void *ext;
 } modbus_mapping_t;
 
+typedef enum {
+    MODBUS_MAPPING_DEFAULT = 0,
+    /* Concurrent accesses are synchronized by a sequence lock */
+    MODBUS_MAPPING_SYNC = (1 << 0),
+    /* The bits and input bits are stored 8 per byte as on the wire */
+    MODBUS_MAPPING_PACKED_BITS = (1 << 1),
+    /* The registers and input registers are stored in big-endian as on the wire */
+    MODBUS_MAPPING_WIRE_ORDER = (1 << 2),
+    /* Many ranges of addresses per table (set by modbus_mapping_new_ranges) */
+    MODBUS_MAPPING_SEGMENTED = (1 << 3),
+    /* The tables are in shared memory (set by modbus_mapping_new_shm) */
+    MODBUS_MAPPING_SHARED = (1 << 4)
+} modbus_mapping_flags;
+
+/* Tables of the data model */
+typedef enum {
+    MODBUS_TABLE_BITS = 0,
+    MODBUS_TABLE_INPUT_BITS,
+    MODBUS_TABLE_REGISTERS,
+    MODBUS_TABLE_INPUT_REGISTERS
+} modbus_table;
+
+/* Range of addresses of a segmented mapping */
+typedef struct _modbus_mapping_range {
+    int start;
+    int nb;
+} modbus_mapping_range_t;
+
 typedef enum {
     MODBUS_ERROR_RECOVERY_NONE = 0,
     MODBUS_ERROR_RECOVERY_LINK = (1 << 1),
@@ -226,6 +258,10 @@ MODBUS_API int modbus_read_input_bits(modbus_t *ctx, int addr, int nb, uint8_t *
 MODBUS_API int modbus_read_registers(modbus_t *ctx, int addr, int nb, uint16_t *dest);
 MODBUS_API int
 modbus_read_input_registers(modbus_t *ctx, int addr, int nb, uint16_t *dest);
+MODBUS_API int
+modbus_read_registers_raw(modbus_t *ctx, int addr, int nb, uint16_t *dest);
+MODBUS_API int
+modbus_read_input_registers_raw(modbus_t *ctx, int addr, int nb, uint16_t *dest);
 MODBUS_API int modbus_write_bit(modbus_t *ctx, int coil_addr, int status);
 MODBUS_API int modbus_write_register(modbus_t *ctx, int reg_addr, const uint16_t value);
 MODBUS_API int modbus_write_bits(modbus_t *ctx, int addr, int nb, const uint8_t *data);
@@ -242,6 +278,28 @@ MODBUS_API int modbus_write_and_read_registers(modbus_t *ctx,
                                                uint16_t *dest);
 MODBUS_API int modbus_report_slave_id(modbus_t *ctx, int max_dest, uint8_t *dest);
 
+MODBUS_API int modbus_set_max_pending(modbus_t *ctx, int max_pending);
+MODBUS_API int modbus_get_max_pending(modbus_t *ctx);
+MODBUS_API int modbus_get_nb_pending(modbus_t *ctx);
+MODBUS_API int modbus_send_read_bits(modbus_t *ctx, int addr, int nb, uint8_t *dest);
+MODBUS_API int
+modbus_send_read_input_bits(modbus_t *ctx, int addr, int nb, uint8_t *dest);
+MODBUS_API int
+modbus_send_read_registers(modbus_t *ctx, int addr, int nb, uint16_t *dest);
+MODBUS_API int
+modbus_send_read_input_registers(modbus_t *ctx, int addr, int nb, uint16_t *dest);
+MODBUS_API int modbus_send_write_bit(modbus_t *ctx, int coil_addr, int status);
+MODBUS_API int
+modbus_send_write_register(modbus_t *ctx, int reg_addr, const uint16_t value);
+MODBUS_API int
+modbus_send_write_bits(modbus_t *ctx, int addr, int nb, const uint8_t *data);
+MODBUS_API int
+modbus_send_write_registers(modbus_t *ctx, int addr, int nb, const uint16_t *data);
+MODBUS_API int modbus_receive_completion(modbus_t *ctx, int *tid);
+MODBUS_API int modbus_poll_completion(modbus_t *ctx, int *tid);
+MODBUS_API int
+modbus_get_pending_timeout(modbus_t *ctx, uint32_t *to_sec, uint32_t *to_usec);
+
 MODBUS_API modbus_mapping_t *
 modbus_mapping_new_start_address(unsigned int start_bits,
                                  unsigned int nb_bits,
@@ -256,7 +314,56 @@ MODBUS_API modbus_mapping_t *modbus_mapping_new(int nb_bits,
                                                 int nb_input_bits,
                                                 int nb_registers,
                                                 int nb_input_registers);
+MODBUS_API modbus_mapping_t *modbus_mapping_new_ext(unsigned int start_bits,
+                                                    unsigned int nb_bits,
+                                                    unsigned int start_input_bits,
+                                                    unsigned int nb_input_bits,
+                                                    unsigned int start_registers,
+                                                    unsigned int nb_registers,
+                                                    unsigned int start_input_registers,
+                                                    unsigned int nb_input_registers,
+                                                    unsigned int flags);
+MODBUS_API modbus_mapping_t *
+modbus_mapping_new_ranges(const modbus_mapping_range_t *bits_ranges,
+                          int nb_bits_ranges,
+                          const modbus_mapping_range_t *input_bits_ranges,
+                          int nb_input_bits_ranges,
+                          const modbus_mapping_range_t *registers_ranges,
+                          int nb_registers_ranges,
+                          const modbus_mapping_range_t *input_registers_ranges,
+                          int nb_input_registers_ranges,
+                          unsigned int flags);
+MODBUS_API modbus_mapping_t *modbus_mapping_new_shm(const char *name,
+                                                    unsigned int start_bits,
+                                                    unsigned int nb_bits,
+                                                    unsigned int start_input_bits,
+                                                    unsigned int nb_input_bits,
+                                                    unsigned int start_registers,
+                                                    unsigned int nb_registers,
+                                                    unsigned int start_input_registers,
+                                                    unsigned int nb_input_registers,
+                                                    unsigned int flags);
+MODBUS_API modbus_mapping_t *modbus_mapping_attach_shm(const char *name);
+MODBUS_API int modbus_mapping_unlink_shm(const char *name);
 MODBUS_API void modbus_mapping_free(modbus_mapping_t *mb_mapping);
+MODBUS_API int modbus_mapping_get_index(const modbus_mapping_t *mb_mapping,
+                                        modbus_table table,
+                                        int addr,
+                                        int nb);
+
+MODBUS_API uint16_t modbus_mapping_get_register(const modbus_mapping_t *mb_mapping,
+                                                int idx);
+MODBUS_API void
+modbus_mapping_set_register(modbus_mapping_t *mb_mapping, int idx, uint16_t value);
+MODBUS_API uint16_t
+modbus_mapping_get_input_register(const modbus_mapping_t *mb_mapping, int idx);
+MODBUS_API void
+modbus_mapping_set_input_register(modbus_mapping_t *mb_mapping, int idx, uint16_t value);
+
+MODBUS_API void modbus_mapping_write_begin(modbus_mapping_t *mb_mapping);
+MODBUS_API void modbus_mapping_write_end(modbus_mapping_t *mb_mapping);
+MODBUS_API unsigned int modbus_mapping_read_begin(modbus_mapping_t *mb_mapping);
+MODBUS_API int modbus_mapping_read_retry(modbus_mapping_t *mb_mapping, unsigned int seq);
 
 MODBUS_API int
 modbus_send_raw_request(modbus_t *ctx, const uint8_t *raw_req, int raw_req_length);
@@ -276,6 +383,29 @@ MODBUS_API int modbus_reply(modbus_t *ctx,
                             modbus_mapping_t *mb_mapping);
 MODBUS_API int
 modbus_reply_exception(modbus_t *ctx, const uint8_t *req, unsigned int exception_code);
+
+/* Replies a request without mapping, the values to write are given in values
+   and the values to read are written to dest (as in the Modbus frames). Returns
+   0 or a Modbus exception code. */
+typedef int (*modbus_reply_handler_t)(modbus_t *ctx,
+                                      int function,
+                                      int addr,
+                                      int nb,
+                                      const uint8_t *values,
+                                      uint8_t *dest,
+                                      void *user_data);
+
+MODBUS_API int modbus_set_reply_handler(modbus_t *ctx,
+                                        int function,
+                                        modbus_reply_handler_t handler,
+                                        void *user_data);
+
+/* Response completed later, from any thread, by a handler which defers it */
+typedef struct _modbus_deferred modbus_deferred_t;
+
+MODBUS_API modbus_deferred_t *modbus_reply_defer(modbus_t *ctx);
+MODBUS_API uint8_t *modbus_deferred_get_dest(modbus_deferred_t *deferred);
+MODBUS_API int modbus_deferred_reply(modbus_deferred_t *deferred, int exception_code);
 MODBUS_API int modbus_enable_quirks(modbus_t *ctx, unsigned int quirks_mask);
 MODBUS_API int modbus_disable_quirks(modbus_t *ctx, unsigned int quirks_mask);
 
@@ -330,6 +460,68 @@ MODBUS_API void modbus_set_float_dcba(float f, uint16_t *dest);
 MODBUS_API void modbus_set_float_badc(float f, uint16_t *dest);
 MODBUS_API void modbus_set_float_cdab(float f, uint16_t *dest);
 
+/* Order of the bytes of a 32-bit value in the registers, the 64-bit values
+   follow the same principle (ABCD = ABCDEFGH, CDAB = GHEFCDAB, etc).
+   MODBUS_ORDER_WIRE can be added to an order when the registers are stored in
+   big-endian (modbus_read_registers_raw, MODBUS_MAPPING_WIRE_ORDER). */
+typedef enum {
+    MODBUS_ORDER_ABCD = 0,
+    MODBUS_ORDER_DCBA,
+    MODBUS_ORDER_BADC,
+    MODBUS_ORDER_CDAB,
+    MODBUS_ORDER_WIRE = 0x10
+} modbus_value_order;
+
+MODBUS_API int modbus_get_float_array(const uint16_t *src,
+                                      int nb,
+                                      float *dest,
+                                      modbus_value_order order);
+MODBUS_API int modbus_get_double_array(const uint16_t *src,
+                                       int nb,
+                                       double *dest,
+                                       modbus_value_order order);
+MODBUS_API int modbus_get_int32_array(const uint16_t *src,
+                                      int nb,
+                                      int32_t *dest,
+                                      modbus_value_order order);
+MODBUS_API int modbus_get_uint32_array(const uint16_t *src,
+                                       int nb,
+                                       uint32_t *dest,
+                                       modbus_value_order order);
+MODBUS_API int modbus_get_int64_array(const uint16_t *src,
+                                      int nb,
+                                      int64_t *dest,
+                                      modbus_value_order order);
+MODBUS_API int modbus_get_uint64_array(const uint16_t *src,
+                                       int nb,
+                                       uint64_t *dest,
+                                       modbus_value_order order);
+
+MODBUS_API int modbus_set_float_array(const float *src,
+                                      int nb,
+                                      uint16_t *dest,
+                                      modbus_value_order order);
+MODBUS_API int modbus_set_double_array(const double *src,
+                                       int nb,
+                                       uint16_t *dest,
+                                       modbus_value_order order);
+MODBUS_API int modbus_set_int32_array(const int32_t *src,
+                                      int nb,
+                                      uint16_t *dest,
+                                      modbus_value_order order);
+MODBUS_API int modbus_set_uint32_array(const uint32_t *src,
+                                       int nb,
+                                       uint16_t *dest,
+                                       modbus_value_order order);
+MODBUS_API int modbus_set_int64_array(const int64_t *src,
+                                      int nb,
+                                      uint16_t *dest,
+                                      modbus_value_order order);
+MODBUS_API int modbus_set_uint64_array(const uint64_t *src,
+                                       int nb,
+                                       uint16_t *dest,
+                                       modbus_value_order order);
+
 #include "modbus-rtu.h"
 #include "modbus-tcp.h"
 
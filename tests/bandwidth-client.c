@@ -59,7 +59,8 @@ int main(int argc, char *argv[])
             use_backend = RTU;
             n_loop = 100;
         } else {
-            printf("Usage:\n  %s [tcp|rtu] - Modbus client to measure data bandwidth\n\n",
+            printf("Usage:\n  %s [tcp|rtu [device [baud]]] - Modbus client to measure "
+                   "data bandwidth\n\n",
                    argv[0]);
             exit(1);
         }
@@ -72,7 +73,12 @@ int main(int argc, char *argv[])
     if (use_backend == TCP) {
         ctx = modbus_new_tcp("127.0.0.1", 1502);
     } else {
-        ctx = modbus_new_rtu("/dev/ttyUSB1", 115200, 'N', 8, 1);
+        /* The device can be a pseudo-terminal bridged by rtu-pty-benchmark -s */
+        ctx = modbus_new_rtu(argc > 2 ? argv[2] : "/dev/ttyUSB1",
+                             argc > 3 ? atoi(argv[3]) : 115200,
+                             'N',
+                             8,
+                             1);
         modbus_set_slave(ctx, 1);
     }
     if (modbus_connect(ctx) == -1) {
@@ -0,0 +1,92 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <modbus.h>
+
+#define NB_CONNECTION 1024
+
+static modbus_server_t *server = NULL;
+
+static void stop_sigint(int dummy)
+{
+    (void) dummy;
+    modbus_server_stop(server);
+}
+
+int main(int argc, char *argv[])
+{
+    modbus_t *ctx;
+    modbus_mapping_t *mb_mapping;
+    int server_socket = -1;
+    int nb_workers = 0;
+    int rc;
+
+    if (argc > 1) {
+        nb_workers = atoi(argv[1]);
+        if (nb_workers < 1) {
+            printf("Usage:\n  %s [nb_workers]\n", argv[0]);
+            printf("Each worker runs in its own thread (SO_REUSEPORT)\n");
+            exit(1);
+        }
+    }
+
+    ctx = modbus_new_tcp("127.0.0.1", 1502);
+
+    mb_mapping =
+        modbus_mapping_new(MODBUS_MAX_READ_BITS, 0, MODBUS_MAX_READ_REGISTERS, 0);
+    if (mb_mapping == NULL) {
+        fprintf(stderr, "Failed to allocate the mapping: %s\n", modbus_strerror(errno));
+        modbus_free(ctx);
+        return -1;
+    }
+
+    if (nb_workers > 0) {
+        /* The workers create their own listening sockets */
+        server = modbus_server_new_workers(ctx, NB_CONNECTION, nb_workers, mb_mapping);
+    } else {
+        server_socket = modbus_tcp_listen(ctx, NB_CONNECTION);
+        if (server_socket == -1) {
+            fprintf(stderr, "Unable to listen TCP connection\n");
+            modbus_mapping_free(mb_mapping);
+            modbus_free(ctx);
+            return -1;
+        }
+
+        /* All the connections are handled by the server engine */
+        server = modbus_server_new(ctx, server_socket, mb_mapping);
+    }
+    if (server == NULL) {
+        fprintf(stderr, "Unable to create the server: %s\n", modbus_strerror(errno));
+        if (server_socket != -1)
+            close(server_socket);
+        modbus_mapping_free(mb_mapping);
+        modbus_free(ctx);
+        return -1;
+    }
+
+    signal(SIGINT, stop_sigint);
+
+    rc = modbus_server_run(server);
+    if (rc == -1) {
+        fprintf(stderr, "Server failure: %s\n", modbus_strerror(errno));
+    }
+
+    printf("Quit the loop (%d connections)\n", modbus_server_get_nb_connections(server));
+
+    modbus_server_free(server);
+    if (server_socket != -1)
+        close(server_socket);
+    modbus_mapping_free(mb_mapping);
+    modbus_free(ctx);
+
+    return (rc == -1) ? -1 : 0;
+}
@@ -38,7 +38,8 @@ int main(int argc, char *argv[])
         } else if (strcmp(argv[1], "rtu") == 0) {
             use_backend = RTU;
         } else {
-            printf("Usage:\n  %s [tcp|rtu] - Modbus client to measure data bandwidth\n\n",
+            printf("Usage:\n  %s [tcp|rtu [device [baud]]] - Modbus server to measure "
+                   "data bandwidth\n\n",
                    argv[0]);
             exit(1);
         }
@@ -53,7 +54,12 @@ int main(int argc, char *argv[])
         modbus_tcp_accept(ctx, &s);
 
     } else {
-        ctx = modbus_new_rtu("/dev/ttyUSB0", 115200, 'N', 8, 1);
+        /* The device can be a pseudo-terminal bridged by rtu-pty-benchmark -s */
+        ctx = modbus_new_rtu(argc > 2 ? argv[2] : "/dev/ttyUSB0",
+                             argc > 3 ? atoi(argv[3]) : 115200,
+                             'N',
+                             8,
+                             1);
         modbus_set_slave(ctx, 1);
         modbus_connect(ctx);
     }
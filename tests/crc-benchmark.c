@@ -0,0 +1,100 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Measures the CRC-16 of the RTU frames against the byte-at-a-time algorithm.
+ */
+
+#include <stdio.h>
+#ifndef _MSC_VER
+#include <sys/time.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Internal function of libmodbus, the source file is built with the program */
+uint16_t _modbus_crc16(const uint8_t *buffer, int buffer_length);
+
+#define NB_LOOPS 1000000
+
+static uint16_t table_crc[256];
+
+static double gettime_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (double) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void init_table(void)
+{
+    int i, j;
+
+    for (i = 0; i < 256; i++) {
+        uint16_t crc = i;
+        for (j = 0; j < 8; j++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+        table_crc[i] = crc;
+    }
+}
+
+/* Byte-at-a-time reference */
+static uint16_t crc16_bytewise(const uint8_t *buffer, int buffer_length)
+{
+    uint16_t crc = 0xFFFF;
+
+    while (buffer_length--)
+        crc = (crc >> 8) ^ table_crc[(crc ^ *buffer++) & 0xFF];
+
+    return crc;
+}
+
+int main(void)
+{
+    const int lengths[] = {8, 64, 256};
+    uint8_t buffer[256];
+    volatile uint16_t crc = 0;
+    double start, elapsed_ref, elapsed;
+    int i, n, k;
+
+    init_table();
+    for (i = 0; i < (int) sizeof(buffer); i++)
+        buffer[i] = rand();
+
+    for (i = 0; i <= (int) sizeof(buffer); i++) {
+        if (_modbus_crc16(buffer, i) != crc16_bytewise(buffer, i)) {
+            printf("CRC mismatch for a length of %d bytes\n", i);
+            return 1;
+        }
+    }
+
+    for (k = 0; k < (int) (sizeof(lengths) / sizeof(lengths[0])); k++) {
+        n = lengths[k];
+
+        start = gettime_us();
+        for (i = 0; i < NB_LOOPS; i++) {
+            buffer[0] = i;
+            crc ^= crc16_bytewise(buffer, n);
+        }
+        elapsed_ref = gettime_us() - start;
+
+        start = gettime_us();
+        for (i = 0; i < NB_LOOPS; i++) {
+            buffer[0] = i;
+            crc ^= _modbus_crc16(buffer, n);
+        }
+        elapsed = gettime_us() - start;
+
+        printf("%3d bytes: byte-at-a-time %6.1f ns, slicing-by-8 %6.1f ns (x%.2f), "
+               "%.0f MiB/s\n",
+               n,
+               elapsed_ref * 1000 / NB_LOOPS,
+               elapsed * 1000 / NB_LOOPS,
+               elapsed_ref / elapsed,
+               (double) n * NB_LOOPS / elapsed * 1000000 / (1024 * 1024));
+    }
+
+    return 0;
+}
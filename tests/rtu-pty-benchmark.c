@@ -0,0 +1,553 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Measures the RTU code path without serial hardware: the client and the server
+ * are connected by two pseudo-terminals bridged by threads which can emulate the
+ * time to send each character at a baud rate.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <modbus.h>
+
+/* Internal function of libmodbus, the source file is built with the program */
+uint16_t _modbus_crc16(const uint8_t *buffer, int buffer_length);
+
+#define SERVER_ID   1
+#define NB_CRC_LOOP 100000
+/* Max number of requests sent until the server replies */
+#define NB_WARM_UP 50
+
+typedef struct {
+    int from;
+    int to;
+    /* Time to send a character and gap after each one, no pacing when 0 */
+    long onebyte_ns;
+    long gap_ns;
+} bridge_t;
+
+typedef struct {
+    const char *device;
+    int baud;
+    int framing;
+    int low_latency;
+    volatile sig_atomic_t stop;
+    /* Time spent in modbus_reply, write of the response included */
+    double *turnaround_samples;
+    int max_replies;
+    int nb_replies;
+} server_t;
+
+typedef struct {
+    int fd;
+    int req_length;
+    int rsp_length;
+    int n_loop;
+    /* Time spent to write each response */
+    double *write_samples;
+    int nb_writes;
+} raw_t;
+
+static double gettime_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until_ns(double deadline)
+{
+    double delay = deadline - gettime_ns();
+    struct timespec ts;
+
+    if (delay <= 0)
+        return;
+
+    ts.tv_sec = (time_t) (delay / 1000000000);
+    ts.tv_nsec = (long) (delay - (double) ts.tv_sec * 1000000000);
+    nanosleep(&ts, NULL);
+}
+
+static int open_pty(char *name, size_t name_size)
+{
+    struct termios tios;
+    int fd;
+
+    fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0) {
+        return -1;
+    }
+
+    /* The master side doesn't process the characters */
+    tcgetattr(fd, &tios);
+    cfmakeraw(&tios);
+    tcsetattr(fd, TCSANOW, &tios);
+
+    snprintf(name, name_size, "%s", ptsname(fd));
+    return fd;
+}
+
+/* Copies the characters of a pseudo-terminal to the other one, paced like a
+   serial line when a baud rate is set */
+static void *bridge_run(void *arg)
+{
+    bridge_t *bridge = arg;
+    uint8_t buf[MODBUS_RTU_MAX_ADU_LENGTH];
+    double wire_end = 0;
+    ssize_t rc;
+    int i;
+
+    for (;;) {
+        rc = read(bridge->from, buf, sizeof(buf));
+        if (rc <= 0) {
+            if (rc == -1 && errno == EINTR)
+                continue;
+            /* EIO when the slave side is closed, waits for a new opening */
+            usleep(1000);
+            continue;
+        }
+
+        if (bridge->onebyte_ns == 0 && bridge->gap_ns == 0) {
+            if (write(bridge->to, buf, rc) != rc)
+                return NULL;
+            continue;
+        }
+
+        /* The line is idle or still sending the previous characters */
+        if (wire_end < gettime_ns())
+            wire_end = gettime_ns();
+        for (i = 0; i < rc; i++) {
+            wire_end += bridge->onebyte_ns;
+            sleep_until_ns(wire_end);
+            if (write(bridge->to, buf + i, 1) != 1)
+                return NULL;
+            wire_end += bridge->gap_ns;
+        }
+    }
+
+    return NULL;
+}
+
+static modbus_t *new_rtu(const char *device, int baud, int framing, int low_latency)
+{
+    modbus_t *ctx;
+
+    ctx = modbus_new_rtu(device, baud, 'N', 8, 1);
+    if (ctx == NULL)
+        return NULL;
+
+    modbus_set_slave(ctx, SERVER_ID);
+    modbus_rtu_set_framing(ctx, framing);
+    if (low_latency)
+        modbus_rtu_set_low_latency(ctx, MODBUS_RTU_LOW_LATENCY_ALL);
+    if (modbus_connect(ctx) == -1) {
+        fprintf(stderr, "Connection to %s failed: %s\n", device, modbus_strerror(errno));
+        modbus_free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+static void *server_run(void *arg)
+{
+    server_t *server = arg;
+    modbus_mapping_t *mb_mapping;
+    uint8_t query[MODBUS_RTU_MAX_ADU_LENGTH];
+    modbus_t *ctx;
+    double start;
+    int rc;
+
+    ctx = new_rtu(server->device, server->baud, server->framing, server->low_latency);
+    if (ctx == NULL)
+        return NULL;
+    modbus_set_indication_timeout(ctx, 0, 100000);
+
+    mb_mapping = modbus_mapping_new(0, 0, MODBUS_MAX_READ_REGISTERS, 0);
+    while (!server->stop) {
+        rc = modbus_receive(ctx, query);
+        if (rc > 0) {
+            start = gettime_ns();
+            modbus_reply(ctx, query, rc, mb_mapping);
+            if (server->nb_replies < server->max_replies)
+                server->turnaround_samples[server->nb_replies++] = gettime_ns() - start;
+        }
+    }
+
+    modbus_mapping_free(mb_mapping);
+    modbus_close(ctx);
+    modbus_free(ctx);
+
+    return NULL;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* The median is less sensitive than the mean to the scheduling of the threads */
+static double median(double *samples, int n)
+{
+    qsort(samples, n, sizeof(double), compare_double);
+    return samples[n / 2];
+}
+
+static int write_all(int fd, const uint8_t *buf, int length)
+{
+    ssize_t rc;
+
+    while (length > 0) {
+        rc = write(fd, buf, length);
+        if (rc < 0)
+            return -1;
+        buf += rc;
+        length -= rc;
+    }
+
+    return 0;
+}
+
+static int read_all(int fd, uint8_t *buf, int length)
+{
+    ssize_t rc;
+
+    while (length > 0) {
+        rc = read(fd, buf, length);
+        if (rc <= 0)
+            return -1;
+        buf += rc;
+        length -= rc;
+    }
+
+    return 0;
+}
+
+static int open_raw(const char *device)
+{
+    struct termios tios;
+    int fd;
+
+    fd = open(device, O_RDWR | O_NOCTTY);
+    if (fd >= 0) {
+        tcgetattr(fd, &tios);
+        cfmakeraw(&tios);
+        tcsetattr(fd, TCSANOW, &tios);
+    }
+
+    return fd;
+}
+
+/* Replies the raw frames of the transport measure */
+static void *echo_run(void *arg)
+{
+    raw_t *raw = arg;
+    uint8_t buf[MODBUS_RTU_MAX_ADU_LENGTH] = {0};
+    double start;
+    int i;
+
+    for (i = 0; i < raw->n_loop; i++) {
+        if (read_all(raw->fd, buf, raw->req_length) == -1)
+            break;
+        start = gettime_ns();
+        if (write_all(raw->fd, buf, raw->rsp_length) == -1)
+            break;
+        raw->write_samples[raw->nb_writes++] = gettime_ns() - start;
+    }
+
+    return NULL;
+}
+
+/* Round trip of the frames of a read of registers exchanged as raw bytes
+   between two threads, the cost of the transport only */
+static double measure_transport(const char *client_device,
+                                const char *server_device,
+                                int req_length,
+                                int rsp_length,
+                                double *samples,
+                                double *write_samples,
+                                int n_loop,
+                                double *write_ns)
+{
+    uint8_t buf[MODBUS_RTU_MAX_ADU_LENGTH] = {0};
+    double start, elapsed = -1;
+    pthread_t thread;
+    raw_t raw;
+    int fd_client;
+    int i;
+
+    *write_ns = 0;
+    raw.fd = open_raw(server_device);
+    fd_client = open_raw(client_device);
+    if (raw.fd < 0 || fd_client < 0)
+        goto out;
+
+    raw.req_length = req_length;
+    raw.rsp_length = rsp_length;
+    raw.n_loop = n_loop;
+    raw.write_samples = write_samples;
+    raw.nb_writes = 0;
+    pthread_create(&thread, NULL, echo_run, &raw);
+
+    for (i = 0; i < n_loop; i++) {
+        start = gettime_ns();
+        if (write_all(fd_client, buf, req_length) == -1 ||
+            read_all(fd_client, buf, rsp_length) == -1)
+            break;
+        samples[i] = gettime_ns() - start;
+    }
+    if (i == n_loop)
+        elapsed = median(samples, n_loop);
+    pthread_join(thread, NULL);
+    if (raw.nb_writes > 0)
+        *write_ns = median(write_samples, raw.nb_writes);
+
+out:
+    if (fd_client >= 0)
+        close(fd_client);
+    if (raw.fd >= 0)
+        close(raw.fd);
+
+    return elapsed;
+}
+
+/* Round trip of modbus_read_registers, the server thread measures the time to
+   reply. The samples have room for the replies of the warm up. */
+static double measure_modbus(const char *client_device,
+                             server_t *server,
+                             int nb_points,
+                             double *samples,
+                             double *turnaround_samples,
+                             int n_loop,
+                             double *turnaround_ns)
+{
+    uint16_t tab_reg[MODBUS_MAX_READ_REGISTERS];
+    pthread_t thread;
+    modbus_t *ctx;
+    double start, elapsed = -1;
+    int i;
+
+    server->stop = 0;
+    server->turnaround_samples = turnaround_samples;
+    server->max_replies = n_loop + NB_WARM_UP;
+    server->nb_replies = 0;
+    pthread_create(&thread, NULL, server_run, server);
+
+    ctx = new_rtu(client_device, server->baud, server->framing, server->low_latency);
+    if (ctx != NULL) {
+        /* The server is ready once it replies */
+        for (i = 0; i < NB_WARM_UP && modbus_read_registers(ctx, 0, 1, tab_reg) == -1;
+             i++)
+            ;
+
+        for (i = 0; i < n_loop; i++) {
+            start = gettime_ns();
+            if (modbus_read_registers(ctx, 0, nb_points, tab_reg) != nb_points) {
+                fprintf(stderr, "Read failed: %s\n", modbus_strerror(errno));
+                break;
+            }
+            samples[i] = gettime_ns() - start;
+        }
+        if (i == n_loop)
+            elapsed = median(samples, n_loop);
+
+        modbus_close(ctx);
+        modbus_free(ctx);
+    }
+
+    server->stop = 1;
+    pthread_join(thread, NULL);
+    /* The first reply (warm up) is skipped */
+    *turnaround_ns = server->nb_replies > 1 ? median(turnaround_samples + 1,
+                                                     server->nb_replies - 1)
+                                            : 0;
+
+    return elapsed;
+}
+
+static double measure_crc(int length)
+{
+    uint8_t buf[MODBUS_RTU_MAX_ADU_LENGTH] = {0};
+    volatile uint16_t crc = 0;
+    double start;
+    int i;
+
+    start = gettime_ns();
+    for (i = 0; i < NB_CRC_LOOP; i++) {
+        buf[0] = i;
+        crc ^= _modbus_crc16(buf, length);
+    }
+
+    return (gettime_ns() - start) / NB_CRC_LOOP;
+}
+
+static void usage(const char *name)
+{
+    printf("Usage:\n  %s [-n loops] [-r registers] [-b baud] [-g gap_us] [-l] [-s]\n\n"
+           "  -b  emulates the time to send each character at the baud rate\n"
+           "  -g  adds a gap after each character (microseconds)\n"
+           "  -l  enables the low latency options of the serial ports\n"
+           "  -s  only bridges two pseudo-terminals (eg. for bandwidth-client rtu)\n",
+           name);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    char client_device[64];
+    char server_device[64];
+    bridge_t bridges[2];
+    pthread_t threads[2];
+    server_t server;
+    int master_client, master_server;
+    int n_loop = 1000;
+    int nb_points = 10;
+    int baud = 0;
+    int gap_us = 0;
+    int low_latency = 0;
+    int bridge_only = 0;
+    int req_length, rsp_length;
+    double transport, write_ns, crc;
+    double rtt[2], turnaround[2];
+    double *samples;
+    double *server_samples;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "n:r:b:g:ls")) != -1) {
+        switch (opt) {
+        case 'n':
+            n_loop = atoi(optarg);
+            break;
+        case 'r':
+            nb_points = atoi(optarg);
+            break;
+        case 'b':
+            baud = atoi(optarg);
+            break;
+        case 'g':
+            gap_us = atoi(optarg);
+            break;
+        case 'l':
+            low_latency = 1;
+            break;
+        case 's':
+            bridge_only = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (n_loop <= 0 || nb_points <= 0 || nb_points > MODBUS_MAX_READ_REGISTERS ||
+        baud < 0 || gap_us < 0)
+        usage(argv[0]);
+
+    master_client = open_pty(client_device, sizeof(client_device));
+    master_server = open_pty(server_device, sizeof(server_device));
+    if (master_client < 0 || master_server < 0) {
+        fprintf(stderr, "Unable to open the pseudo-terminals: %s\n", strerror(errno));
+        return 1;
+    }
+
+    for (i = 0; i < 2; i++) {
+        bridges[i].from = i == 0 ? master_client : master_server;
+        bridges[i].to = i == 0 ? master_server : master_client;
+        /* Start, data and stop bits (8N1) */
+        bridges[i].onebyte_ns = baud ? 10 * 1000000000L / baud : 0;
+        bridges[i].gap_ns = gap_us * 1000L;
+        pthread_create(&threads[i], NULL, bridge_run, &bridges[i]);
+    }
+
+    if (bridge_only) {
+        printf("Client side: %s\nServer side: %s\n", client_device, server_device);
+        fflush(stdout);
+        pthread_join(threads[0], NULL);
+        return 0;
+    }
+
+    /* Slave, function, address, number and CRC */
+    req_length = 8;
+    /* Slave, function, byte count, values and CRC */
+    rsp_length = 5 + nb_points * 2;
+
+    printf("RTU over pseudo-terminals, %d x read of %d registers, ", n_loop, nb_points);
+    if (baud)
+        printf("paced at %d bauds", baud);
+    else
+        printf("no pacing");
+    if (gap_us)
+        printf(", %d us between the characters", gap_us);
+    printf("%s\n\n", low_latency ? ", low latency" : "");
+
+    samples = malloc(n_loop * sizeof(double));
+    server_samples = malloc((n_loop + NB_WARM_UP) * sizeof(double));
+    if (samples == NULL || server_samples == NULL) {
+        fprintf(stderr, "Unable to allocate the samples\n");
+        return 1;
+    }
+
+    transport = measure_transport(client_device,
+                                  server_device,
+                                  req_length,
+                                  rsp_length,
+                                  samples,
+                                  server_samples,
+                                  n_loop,
+                                  &write_ns);
+    if (transport < 0) {
+        fprintf(stderr, "Transport failed: %s\n", strerror(errno));
+        return 1;
+    }
+
+    crc = measure_crc(req_length - 2) + measure_crc(rsp_length - 2);
+
+    server.device = server_device;
+    server.baud = baud ? baud : 115200;
+    server.low_latency = low_latency;
+    for (i = 0; i < 2; i++) {
+        server.framing = i == 0 ? MODBUS_RTU_FRAMING_LENGTH : MODBUS_RTU_FRAMING_SILENCE;
+        rtt[i] = measure_modbus(client_device,
+                                &server,
+                                nb_points,
+                                samples,
+                                server_samples,
+                                n_loop,
+                                &turnaround[i]);
+        if (rtt[i] < 0)
+            return 1;
+    }
+
+    printf("Medians of the samples\n\n");
+    printf("Transport round trip (raw frames):     %9.1f us\n", transport / 1000);
+    printf("Write of the response (raw frame):     %9.1f us\n", write_ns / 1000);
+    printf("CRC of the request and the response:   %9.0f ns (x2, sent and checked)\n",
+           crc);
+    for (i = 0; i < 2; i++) {
+        printf("\n%s framing\n", i == 0 ? "Length" : "Silence");
+        printf("libmodbus round trip:                  %9.1f us\n", rtt[i] / 1000);
+        printf("Server turnaround (with the write):    %9.1f us\n", turnaround[i] / 1000);
+        /* The write of the response is counted by the transport and by the
+           turnaround, it's an estimate from the medians of two runs */
+        printf("Receive and framing (remaining):       %9.1f us\n",
+               (rtt[i] - transport - turnaround[i] + write_ns) / 1000);
+    }
+    free(server_samples);
+    free(samples);
+
+    return 0;
+}
@@ -5,10 +5,14 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <modbus.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 #include "unit-test.h"
@@ -32,6 +36,7 @@ int send_crafted_request(modbus_t *ctx,
                          int backend_offset);
 int equal_dword(uint16_t *tab_reg, const uint32_t value);
 int is_memory_equal(const void *s1, const void *s2, size_t size);
+int reply_local(modbus_t *ctx, modbus_t *ctx_server, modbus_mapping_t *mb_mapping);
 
 #define BUG_REPORT(_cond, _format, _args...) \
     printf(                                  \
@@ -57,6 +62,23 @@ int equal_dword(uint16_t *tab_reg, const uint32_t value)
     return ((tab_reg[0] == (value >> 16)) && (tab_reg[1] == (value & 0xFFFF)));
 }
 
+/* Replies to the request sent by a modbus_send_* function of ctx with the
+   server context at the other end of the connection, returns the completion */
+int reply_local(modbus_t *ctx, modbus_t *ctx_server, modbus_mapping_t *mb_mapping)
+{
+    uint8_t query[MODBUS_TCP_MAX_ADU_LENGTH];
+    int tid;
+    int rc;
+
+    rc = modbus_receive(ctx_server, query);
+    if (rc > 0)
+        rc = modbus_reply(ctx_server, query, rc, mb_mapping);
+    if (rc == -1)
+        return -1;
+
+    return modbus_receive_completion(ctx, &tid);
+}
+
 int main(int argc, char *argv[])
 {
     /* Length of report slave ID response slave ID + ON/OFF + 'LMB' + version */
@@ -263,6 +285,23 @@ int main(int argc, char *argv[])
                     UT_REGISTERS_TAB[i]);
     }
 
+    {
+        uint16_t tab_raw[UT_REGISTERS_NB];
+        const uint8_t *bytes = (const uint8_t *) tab_raw;
+
+        rc = modbus_read_registers_raw(
+            ctx, UT_REGISTERS_ADDRESS, UT_REGISTERS_NB, tab_raw);
+        printf("* modbus_read_registers_raw: ");
+        ASSERT_TRUE(rc == UT_REGISTERS_NB, "FAILED (nb points %d)\n", rc);
+        for (i = 0; i < UT_REGISTERS_NB; i++) {
+            ASSERT_TRUE(bytes[2 * i] == UT_REGISTERS_TAB[i] >> 8 &&
+                            bytes[2 * i + 1] == (UT_REGISTERS_TAB[i] & 0xFF),
+                        "FAILED (%0X != %0X)\n",
+                        (bytes[2 * i] << 8) | bytes[2 * i + 1],
+                        UT_REGISTERS_TAB[i]);
+        }
+    }
+
     rc = modbus_read_registers(ctx, UT_REGISTERS_ADDRESS, 0, tab_rp_registers);
     printf("3/5 modbus_read_registers (0): ");
     ASSERT_TRUE(rc == -1, "FAILED (nb_points %d)\n", rc);
@@ -349,6 +388,69 @@ int main(int argc, char *argv[])
     real = modbus_get_float_cdab(UT_IREAL_CDAB);
     ASSERT_TRUE(real == UT_REAL, "FAILED (%f != %f)\n", real, UT_REAL);
 
+    printf("\nTEST VALUE ARRAYS\n");
+    {
+        const uint16_t *ireals[] = {
+            UT_IREAL_ABCD, UT_IREAL_DCBA, UT_IREAL_BADC, UT_IREAL_CDAB};
+        /* Enough values to use the vector and the scalar code */
+        uint16_t tab_ireal[2 * 7];
+        uint16_t tab_set[2 * 7];
+        uint16_t tab_int64[4 * 3];
+        float reals[7];
+        int64_t int64s[3];
+        int order;
+        int ok = TRUE;
+
+        for (order = MODBUS_ORDER_ABCD; order <= MODBUS_ORDER_CDAB; order++) {
+            for (i = 0; i < 7; i++) {
+                tab_ireal[2 * i] = ireals[order][0];
+                tab_ireal[2 * i + 1] = ireals[order][1];
+            }
+            memset(reals, 0, sizeof(reals));
+            modbus_get_float_array(tab_ireal, 7, reals, order);
+            memset(tab_set, 0, sizeof(tab_set));
+            modbus_set_float_array(reals, 7, tab_set, order);
+            for (i = 0; i < 7; i++) {
+                if (reals[i] != UT_REAL)
+                    ok = FALSE;
+            }
+            if (!is_memory_equal(tab_set, tab_ireal, sizeof(tab_ireal)))
+                ok = FALSE;
+        }
+        printf("1/3 Set/get float arrays in all orders: ");
+        ASSERT_TRUE(ok, "FAILED");
+
+        for (i = 0; i < 4 * 3; i++) {
+            tab_int64[i] = 0x0102 + i * 0x0202;
+        }
+        modbus_get_int64_array(tab_int64, 3, int64s, MODBUS_ORDER_ABCD);
+        for (i = 0; i < 3; i++) {
+            if (int64s[i] != (int64_t) MODBUS_GET_INT64_FROM_INT16(tab_int64, 4 * i))
+                ok = FALSE;
+        }
+        printf("2/3 Get int64 array: ");
+        ASSERT_TRUE(ok, "FAILED");
+
+        /* Registers stored as received (big-endian) */
+        for (i = 0; i < 2 * 7; i += 2) {
+            uint8_t *bytes = (uint8_t *) &tab_ireal[i];
+
+            bytes[0] = UT_IREAL_CDAB[0] >> 8;
+            bytes[1] = UT_IREAL_CDAB[0] & 0xFF;
+            bytes[2] = UT_IREAL_CDAB[1] >> 8;
+            bytes[3] = UT_IREAL_CDAB[1] & 0xFF;
+        }
+        memset(reals, 0, sizeof(reals));
+        modbus_get_float_array(
+            tab_ireal, 7, reals, MODBUS_ORDER_CDAB | MODBUS_ORDER_WIRE);
+        for (i = 0; i < 7; i++) {
+            if (reals[i] != UT_REAL)
+                ok = FALSE;
+        }
+        printf("3/3 Get float array from wire order registers: ");
+        ASSERT_TRUE(ok, "FAILED");
+    }
+
     printf("\nAt this point, error messages doesn't mean the test has failed\n");
 
     /** ILLEGAL DATA ADDRESS **/
@@ -729,6 +831,149 @@ int main(int argc, char *argv[])
     printf("* modbus_read_registers at special address: ");
     ASSERT_TRUE(rc == -1 && errno == EMBXSBUSY, "");
 
+    /** PIPELINED REQUESTS **/
+    printf("\nTEST PIPELINED REQUESTS:\n");
+    if (use_backend == RTU) {
+        rc = modbus_set_max_pending(ctx, 2);
+        printf("1/1 No pipelining in RTU: ");
+        ASSERT_TRUE(rc == -1 && errno == EINVAL, "");
+    } else {
+        int tids[3];
+        int tid;
+
+        rc = modbus_set_max_pending(ctx, 3);
+        printf("1/8 modbus_set_max_pending: ");
+        ASSERT_TRUE(rc == 0 && modbus_get_max_pending(ctx) == 3, "");
+
+        memset(tab_rp_registers, 0, UT_REGISTERS_NB * sizeof(uint16_t));
+        tids[0] = modbus_send_write_registers(
+            ctx, UT_REGISTERS_ADDRESS, UT_REGISTERS_NB, UT_REGISTERS_TAB);
+        tids[1] = modbus_send_read_registers(
+            ctx, UT_REGISTERS_ADDRESS, UT_REGISTERS_NB, tab_rp_registers);
+        tids[2] = modbus_send_read_input_bits(
+            ctx, UT_INPUT_BITS_ADDRESS, UT_INPUT_BITS_NB, tab_rp_bits);
+        printf("2/8 modbus_send_*: ");
+        ASSERT_TRUE(tids[0] != -1 && tids[1] != -1 && tids[2] != -1 &&
+                        modbus_get_nb_pending(ctx) == 3,
+                    "");
+
+        rc = modbus_send_write_bit(ctx, UT_BITS_ADDRESS, ON);
+        printf("3/8 Too many pending requests: ");
+        ASSERT_TRUE(rc == -1 && errno == EBUSY, "");
+
+        rc = modbus_receive_completion(ctx, &tid);
+        printf("4/8 Completion of write registers: ");
+        ASSERT_TRUE(rc == UT_REGISTERS_NB && tid == tids[0], "");
+
+        rc = modbus_receive_completion(ctx, &tid);
+        printf("5/8 Completion of read registers: ");
+        ASSERT_TRUE(rc == UT_REGISTERS_NB && tid == tids[1] &&
+                        is_memory_equal(tab_rp_registers,
+                                        UT_REGISTERS_TAB,
+                                        UT_REGISTERS_NB * sizeof(uint16_t)),
+                    "");
+
+        rc = modbus_receive_completion(ctx, &tid);
+        printf("6/8 Completion of read input bits: ");
+        ASSERT_TRUE(rc == UT_INPUT_BITS_NB && tid == tids[2] &&
+                        modbus_get_byte_from_bits(tab_rp_bits, 0, 8) ==
+                            UT_INPUT_BITS_TAB[0] &&
+                        modbus_get_nb_pending(ctx) == 0,
+                    "");
+
+        /* Non-blocking completion */
+        tids[0] = modbus_send_read_registers(
+            ctx, UT_REGISTERS_ADDRESS, UT_REGISTERS_NB, tab_rp_registers);
+        rc = modbus_get_pending_timeout(ctx, &new_response_to_sec, &new_response_to_usec);
+        printf("7/8 modbus_get_pending_timeout: ");
+        ASSERT_TRUE(rc == 0 && new_response_to_sec <= old_response_to_sec, "");
+
+        do {
+            rc = modbus_poll_completion(ctx, &tid);
+            if (rc == -1 && errno == EAGAIN) {
+                usleep(1000);
+            }
+        } while (rc == -1 && errno == EAGAIN);
+        printf("8/8 modbus_poll_completion: ");
+        ASSERT_TRUE(rc == UT_REGISTERS_NB && tid == tids[0] &&
+                        modbus_get_nb_pending(ctx) == 0,
+                    "");
+
+        modbus_set_max_pending(ctx, 1);
+    }
+
+#ifdef UT_ENGINE_PORT
+    /* The unit test server replies by handlers on the engine port */
+    if (use_backend == TCP) {
+        modbus_t *ctx_engine = modbus_new_tcp(ip_or_device, UT_ENGINE_PORT);
+
+        printf("\nTEST SERVER ENGINE:\n");
+        modbus_set_debug(ctx_engine, TRUE);
+        rc = modbus_connect(ctx_engine);
+        printf("1/7 Connection to the engine: ");
+        ASSERT_TRUE(rc == 0, "");
+
+        rc = modbus_write_registers(ctx_engine, 0, UT_REGISTERS_NB, UT_REGISTERS_TAB);
+        printf("2/7 Write by a handler: ");
+        ASSERT_TRUE(rc == UT_REGISTERS_NB, "");
+
+        memset(tab_rp_registers, 0, UT_REGISTERS_NB * sizeof(uint16_t));
+        rc = modbus_read_registers(ctx_engine, 0, UT_REGISTERS_NB, tab_rp_registers);
+        printf("3/7 Read by a handler: ");
+        ASSERT_TRUE(rc == UT_REGISTERS_NB &&
+                        is_memory_equal(tab_rp_registers,
+                                        UT_REGISTERS_TAB,
+                                        UT_REGISTERS_NB * sizeof(uint16_t)),
+                    "");
+
+        rc = modbus_read_registers(
+            ctx_engine, UT_HANDLER_REGISTERS_NB - 1, 2, tab_rp_registers);
+        printf("4/7 Exception of a handler: ");
+        ASSERT_TRUE(rc == -1 && errno == EMBXILADD, "");
+
+        /* The input registers are read by a thread of the server */
+        memset(tab_rp_registers, 0, UT_REGISTERS_NB * sizeof(uint16_t));
+        rc = modbus_read_input_registers(
+            ctx_engine, 0, UT_REGISTERS_NB, tab_rp_registers);
+        printf("5/7 Deferred response: ");
+        ASSERT_TRUE(rc == UT_REGISTERS_NB &&
+                        is_memory_equal(tab_rp_registers,
+                                        UT_REGISTERS_TAB,
+                                        UT_REGISTERS_NB * sizeof(uint16_t)),
+                    "");
+
+        {
+            uint16_t tab_deferred[UT_REGISTERS_NB];
+            int tid_deferred;
+            int tid_read;
+            int tid;
+
+            /* The deferred response is sent after the response of the next
+               request */
+            modbus_set_max_pending(ctx_engine, 2);
+            memset(tab_deferred, 0, sizeof(tab_deferred));
+            tid_deferred = modbus_send_read_input_registers(
+                ctx_engine, 0, UT_REGISTERS_NB, tab_deferred);
+            tid_read = modbus_send_read_registers(
+                ctx_engine, 0, UT_REGISTERS_NB, tab_rp_registers);
+            rc = modbus_receive_completion(ctx_engine, &tid);
+            printf("6/7 Request replied during the deferred one: ");
+            ASSERT_TRUE(rc == UT_REGISTERS_NB && tid == tid_read, "");
+
+            rc = modbus_receive_completion(ctx_engine, &tid);
+            printf("7/7 Deferred response matched by its TID: ");
+            ASSERT_TRUE(rc == UT_REGISTERS_NB && tid == tid_deferred &&
+                            is_memory_equal(tab_deferred,
+                                            UT_REGISTERS_TAB,
+                                            UT_REGISTERS_NB * sizeof(uint16_t)),
+                        "");
+        }
+
+        modbus_close(ctx_engine);
+        modbus_free(ctx_engine);
+    }
+#endif
+
     /** Run a few tests to challenge the server code **/
     if (test_server(ctx, use_backend) == -1) {
         goto close;
@@ -746,6 +991,378 @@ int main(int argc, char *argv[])
     ctx = modbus_new_rtu("/dev/dummy", 0, 'A', 0, 0);
     ASSERT_TRUE(ctx == NULL && errno == EINVAL, "");
 
+    printf("\nTEST RTU OPTIONS:\n");
+    ctx = modbus_new_rtu("/dev/dummy", 9600, 'E', 8, 1);
+    printf("1/6 Silence of 3.5 characters: ");
+    ASSERT_TRUE(modbus_rtu_get_frame_silence(ctx) == 4010, "");
+
+    rc = modbus_rtu_set_framing(ctx, MODBUS_RTU_FRAMING_SILENCE);
+    printf("2/6 Silence framing: ");
+    ASSERT_TRUE(rc == 0 && modbus_rtu_get_framing(ctx) == MODBUS_RTU_FRAMING_SILENCE,
+                "");
+
+    rc = modbus_rtu_set_tx_wait(ctx, 0x10);
+    printf("3/6 Invalid wait of the transmission: ");
+    ASSERT_TRUE(rc == -1 && (errno == EINVAL || errno == ENOTSUP), "");
+
+    rc = modbus_rtu_set_low_latency(ctx, MODBUS_RTU_LOW_LATENCY_VMIN);
+    printf("4/6 Low latency requested before the connection: ");
+    ASSERT_TRUE(
+        (rc == 0 && modbus_rtu_get_low_latency(ctx) == MODBUS_RTU_LOW_LATENCY_VMIN) ||
+            (rc == -1 && errno == ENOTSUP),
+        "");
+
+    {
+        modbus_bus_t *bus = modbus_bus_new(ctx);
+        uint16_t reg;
+
+        rc = modbus_bus_read_registers(bus, MODBUS_BROADCAST_ADDRESS, 0, 1, &reg);
+        printf("5/6 No broadcast read on the bus: ");
+        ASSERT_TRUE(bus != NULL && rc == -1 && errno == EINVAL &&
+                        modbus_bus_read_registers(bus, 1, 0, 1, &reg) == 0 &&
+                        modbus_bus_get_nb_queued(bus) == 1,
+                    "");
+        modbus_bus_free(bus);
+    }
+
+    rc = modbus_rtu_monitor(ctx, NULL, NULL);
+    printf("6/6 Monitor without callback: ");
+    ASSERT_TRUE(rc == -1 && errno == EINVAL, "");
+    modbus_free(ctx);
+    ctx = NULL;
+
+    printf("\nTEST RTU OVER TCP:\n");
+    {
+        const uint8_t read_req[] = {
+            SERVER_ID, MODBUS_FC_READ_HOLDING_REGISTERS, 0, 0, 0, 1};
+        const uint8_t write_req[] = {
+            MODBUS_BROADCAST_ADDRESS, MODBUS_FC_WRITE_SINGLE_REGISTER, 0, 0, 0x56, 0x78};
+        modbus_mapping_t *mb_mapping = modbus_mapping_new(0, 0, 1, 0);
+        modbus_t *ctx_server = modbus_new_rtu_tcp("127.0.0.1", 1502);
+        uint8_t query[MODBUS_RTU_MAX_ADU_LENGTH];
+        uint8_t rsp[MODBUS_RTU_MAX_ADU_LENGTH];
+        int sv[2];
+
+        /* Both ends of a connected socket pair */
+        ctx = modbus_new_rtu_tcp("127.0.0.1", 1502);
+        socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+        modbus_set_socket(ctx, sv[0]);
+        modbus_set_slave(ctx, SERVER_ID);
+        modbus_set_socket(ctx_server, sv[1]);
+        modbus_set_slave(ctx_server, SERVER_ID);
+        mb_mapping->tab_registers[0] = 0x1234;
+
+        modbus_send_raw_request(ctx, read_req, sizeof(read_req));
+        rc = modbus_receive(ctx_server, query);
+        printf("1/6 Request with its CRC: ");
+        ASSERT_TRUE(rc == (int) sizeof(read_req) + 2, "FAILED (%d)\n", rc);
+
+        modbus_reply(ctx_server, query, rc, mb_mapping);
+        rc = modbus_receive_confirmation(ctx, rsp);
+        printf("2/6 Response with its CRC: ");
+        ASSERT_TRUE(rc == 7 && rsp[3] == 0x12 && rsp[4] == 0x34, "FAILED (%d)\n", rc);
+
+        modbus_send_raw_request(ctx, write_req, sizeof(write_req));
+        rc = modbus_receive(ctx_server, query);
+        rc = modbus_reply(ctx_server, query, rc, mb_mapping);
+        printf("3/6 No response to a broadcast: ");
+        ASSERT_TRUE(rc == 0 && mb_mapping->tab_registers[0] == 0x5678, "");
+
+        {
+            /* Transaction of another slave on the bus */
+            const uint8_t other_req[] = {
+                INVALID_SERVER_ID, MODBUS_FC_READ_HOLDING_REGISTERS, 0, 0, 0, 1};
+            const uint8_t other_rsp[] = {
+                INVALID_SERVER_ID, MODBUS_FC_READ_HOLDING_REGISTERS, 2, 0x12, 0x34};
+
+            modbus_send_raw_request(ctx, other_req, sizeof(other_req));
+            modbus_send_raw_request(ctx, other_rsp, sizeof(other_rsp));
+            modbus_send_raw_request(ctx, read_req, sizeof(read_req));
+            rc = modbus_receive(ctx_server, query) == 0 &&
+                 modbus_receive(ctx_server, query) == 0;
+            printf("4/6 Response to another slave skipped: ");
+            ASSERT_TRUE(rc &&
+                            modbus_receive(ctx_server, query) ==
+                                (int) sizeof(read_req) + 2 &&
+                            query[0] == SERVER_ID && query[5] == 1,
+                        "");
+        }
+
+        {
+            /* Response of the merged read, sent in advance by the server */
+            const uint8_t merged_rsp[] = {
+                SERVER_ID, MODBUS_FC_READ_HOLDING_REGISTERS, 8, 0, 1, 0, 2, 0, 3, 0, 4};
+            modbus_bus_t *bus = modbus_bus_new(ctx);
+            uint16_t regs[4];
+            int ids[2];
+            int id;
+
+            rc = modbus_bus_read_registers(bus, SERVER_ID, 0xFFFF, 2, regs);
+            printf("5/6 No read past the address space on the bus: ");
+            ASSERT_TRUE(rc == -1 && errno == EINVAL, "");
+
+            modbus_send_raw_request(ctx_server, merged_rsp, sizeof(merged_rsp));
+            ids[0] = modbus_bus_read_registers(bus, SERVER_ID, 2, 2, regs + 2);
+            ids[1] = modbus_bus_read_registers(bus, SERVER_ID, 0, 2, regs);
+            rc = modbus_bus_complete(bus, &id) == 2 && id == ids[0] &&
+                 modbus_bus_complete(bus, &id) == 2 && id == ids[1];
+            printf("6/6 Contiguous reads merged on the bus: ");
+            ASSERT_TRUE(rc && regs[0] == 1 && regs[3] == 4 &&
+                            modbus_receive(ctx_server, query) == 8 && query[3] == 0 &&
+                            query[5] == 4,
+                        "");
+            modbus_bus_free(bus);
+        }
+
+        modbus_free(ctx_server);
+        modbus_mapping_free(mb_mapping);
+        close(sv[0]);
+        close(sv[1]);
+        modbus_free(ctx);
+        ctx = NULL;
+    }
+
+    /* Test the sequence lock of a local mapping */
+    printf("\nTEST SYNCHRONIZED MAPPING:\n");
+    {
+        modbus_mapping_t *mb_mapping;
+        unsigned int seq;
+
+        mb_mapping = modbus_mapping_new_ext(0, 0, 0, 0, 0, 2, 0, 0, 0x80);
+        printf("1/3 Invalid flags: ");
+        ASSERT_TRUE(mb_mapping == NULL && errno == EINVAL, "");
+
+        mb_mapping = modbus_mapping_new_ext(0, 0, 0, 0, 0, 2, 0, 0, MODBUS_MAPPING_SYNC);
+        seq = modbus_mapping_read_begin(mb_mapping);
+        modbus_mapping_write_begin(mb_mapping);
+        mb_mapping->tab_registers[0] = 0x1234;
+        mb_mapping->tab_registers[1] = 0x5678;
+        modbus_mapping_write_end(mb_mapping);
+        printf("2/3 Read retried after a write: ");
+        ASSERT_TRUE(modbus_mapping_read_retry(mb_mapping, seq), "");
+
+        seq = modbus_mapping_read_begin(mb_mapping);
+        rc = (mb_mapping->tab_registers[0] << 16) | mb_mapping->tab_registers[1];
+        printf("3/3 Consistent read: ");
+        ASSERT_TRUE(!modbus_mapping_read_retry(mb_mapping, seq) && rc == 0x12345678, "");
+        modbus_mapping_free(mb_mapping);
+    }
+
+    printf("\nTEST WIRE ORDER MAPPING:\n");
+    {
+        modbus_mapping_t *mb_mapping;
+        const uint8_t *bytes;
+
+        mb_mapping =
+            modbus_mapping_new_ext(0, 0, 0, 0, 0, 1, 0, 0, MODBUS_MAPPING_WIRE_ORDER);
+        modbus_mapping_set_register(mb_mapping, 0, 0x1234);
+        bytes = (const uint8_t *) mb_mapping->tab_registers;
+        printf("1/1 Big-endian storage: ");
+        ASSERT_TRUE(bytes[0] == 0x12 && bytes[1] == 0x34 &&
+                        modbus_mapping_get_register(mb_mapping, 0) == 0x1234,
+                    "");
+        modbus_mapping_free(mb_mapping);
+    }
+
+    printf("\nTEST PACKED BITS MAPPING:\n");
+    {
+        const uint8_t input_bits[] = {0xAC, 0xDB, 0x35, 0x0F};
+        const uint8_t values[] = {ON, OFF, ON, OFF, OFF, ON, ON, ON, OFF, ON};
+        modbus_mapping_t *mb_mapping;
+        modbus_t *ctx_server = modbus_new_tcp("127.0.0.1", 1502);
+        uint8_t bits[32];
+        int sv[2];
+
+        /* Both ends of a connected socket pair */
+        ctx = modbus_new_tcp("127.0.0.1", 1502);
+        socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+        modbus_set_socket(ctx, sv[0]);
+        modbus_set_socket(ctx_server, sv[1]);
+
+        mb_mapping = modbus_mapping_new_ext(
+            0, 32, 0, 32, 0, 0, 0, 0, MODBUS_MAPPING_PACKED_BITS);
+        memcpy(mb_mapping->tab_input_bits, input_bits, sizeof(input_bits));
+        memset(mb_mapping->tab_bits, 0xFF, 4);
+
+        modbus_send_read_input_bits(ctx, 8, 16, bits);
+        rc = reply_local(ctx, ctx_server, mb_mapping);
+        printf("1/6 Read of aligned input bits: ");
+        ASSERT_TRUE(rc == 16 && modbus_get_byte_from_bits(bits, 0, 8) == 0xDB &&
+                        modbus_get_byte_from_bits(bits, 8, 8) == 0x35,
+                    "");
+
+        /* Bits 3 to 27 of 0x0F35DBAC */
+        modbus_send_read_input_bits(ctx, 3, 25, bits);
+        rc = reply_local(ctx, ctx_server, mb_mapping);
+        printf("2/6 Read of unaligned input bits: ");
+        ASSERT_TRUE(rc == 25 && modbus_get_byte_from_bits(bits, 0, 8) == 0x75 &&
+                        modbus_get_byte_from_bits(bits, 8, 8) == 0xBB &&
+                        modbus_get_byte_from_bits(bits, 16, 8) == 0xE6 && bits[24] == ON,
+                    "");
+
+        modbus_send_write_bits(ctx, 8, 8, values);
+        rc = reply_local(ctx, ctx_server, mb_mapping);
+        printf("3/6 Write of aligned coils: ");
+        ASSERT_TRUE(rc == 8 && mb_mapping->tab_bits[0] == 0xFF &&
+                        mb_mapping->tab_bits[1] == 0xE5 &&
+                        mb_mapping->tab_bits[2] == 0xFF,
+                    "");
+
+        /* Bits 13 to 22, the bits around are kept */
+        modbus_send_write_bits(ctx, 13, 10, values);
+        rc = reply_local(ctx, ctx_server, mb_mapping);
+        printf("4/6 Write of unaligned coils: ");
+        ASSERT_TRUE(rc == 10 && mb_mapping->tab_bits[1] == 0xA5 &&
+                        mb_mapping->tab_bits[2] == 0xDC &&
+                        mb_mapping->tab_bits[3] == 0xFF,
+                    "");
+
+        modbus_send_write_bit(ctx, 31, OFF);
+        rc = reply_local(ctx, ctx_server, mb_mapping);
+        printf("5/6 Write of a single coil: ");
+        ASSERT_TRUE(rc == 1 && mb_mapping->tab_bits[3] == 0x7F, "");
+
+        modbus_send_read_bits(ctx, 13, 10, bits);
+        rc = reply_local(ctx, ctx_server, mb_mapping);
+        printf("6/6 Read of unaligned coils: ");
+        ASSERT_TRUE(rc == 10 && is_memory_equal(bits, values, sizeof(values)), "");
+
+        modbus_mapping_free(mb_mapping);
+        modbus_free(ctx_server);
+        close(sv[0]);
+        close(sv[1]);
+        modbus_free(ctx);
+        ctx = NULL;
+    }
+
+    printf("\nTEST SEGMENTED MAPPING:\n");
+    {
+        modbus_mapping_t *mb_mapping;
+        const modbus_mapping_range_t ranges[] = {{40000, 10}, {100, 20}, {120, 5}};
+        const modbus_mapping_range_t overlapping[] = {{100, 20}, {110, 5}};
+        const modbus_mapping_range_t too_large[] = {{100, INT_MAX}};
+        const modbus_mapping_range_t gap[] = {{100, 10}, {120, 10}};
+        modbus_t *ctx_server = modbus_new_tcp("127.0.0.1", 1502);
+        uint16_t registers[14];
+        int sv[2];
+
+        mb_mapping = modbus_mapping_new_ranges(NULL, 0, NULL, 0, ranges, 3, NULL, 0, 0);
+        printf("1/6 Ranges sorted and merged: ");
+        ASSERT_TRUE(mb_mapping != NULL && mb_mapping->nb_registers == 35 &&
+                        modbus_mapping_get_index(
+                            mb_mapping, MODBUS_TABLE_REGISTERS, 100, 25) == 0 &&
+                        modbus_mapping_get_index(
+                            mb_mapping, MODBUS_TABLE_REGISTERS, 40002, 8) == 27,
+                    "");
+
+        printf("2/6 Address out of the ranges: ");
+        rc = modbus_mapping_get_index(mb_mapping, MODBUS_TABLE_REGISTERS, 40002, 9);
+        ASSERT_TRUE(rc == -1 && errno == EMBXILADD, "");
+        modbus_mapping_free(mb_mapping);
+
+        mb_mapping =
+            modbus_mapping_new_ranges(NULL, 0, NULL, 0, overlapping, 2, NULL, 0, 0);
+        printf("3/6 Overlapping ranges: ");
+        ASSERT_TRUE(mb_mapping == NULL && errno == EINVAL, "");
+
+        mb_mapping =
+            modbus_mapping_new_ranges(NULL, 0, NULL, 0, too_large, 1, NULL, 0, 0);
+        printf("4/6 Range past the address space: ");
+        ASSERT_TRUE(mb_mapping == NULL && errno == EINVAL, "");
+
+        /* Both ends of a connected socket pair */
+        ctx = modbus_new_tcp("127.0.0.1", 1502);
+        socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+        modbus_set_socket(ctx, sv[0]);
+        modbus_set_socket(ctx_server, sv[1]);
+
+        /* Addresses 100 to 109 then 120 to 129 */
+        mb_mapping = modbus_mapping_new_ranges(NULL, 0, NULL, 0, gap, 2, NULL, 0, 0);
+        for (i = 0; i < 20; i++)
+            mb_mapping->tab_registers[i] = 0x100 + i;
+
+        modbus_send_read_registers(ctx, 122, 3, registers);
+        rc = reply_local(ctx, ctx_server, mb_mapping);
+        printf("5/6 Read inside a segment: ");
+        ASSERT_TRUE(rc == 3 && registers[0] == 0x10C && registers[1] == 0x10D &&
+                        registers[2] == 0x10E,
+                    "");
+
+        modbus_send_read_registers(ctx, 108, 14, registers);
+        rc = reply_local(ctx, ctx_server, mb_mapping);
+        printf("6/6 Read across two segments: ");
+        ASSERT_TRUE(rc == -1 && errno == EMBXILADD, "");
+
+        modbus_mapping_free(mb_mapping);
+        modbus_free(ctx_server);
+        close(sv[0]);
+        close(sv[1]);
+        modbus_free(ctx);
+        ctx = NULL;
+    }
+
+    printf("\nTEST REPLY HANDLERS:\n");
+    ctx = modbus_new_tcp("127.0.0.1", 1502);
+    rc = modbus_set_reply_handler(ctx, MODBUS_FC_WRITE_AND_READ_REGISTERS, NULL, NULL);
+    printf("1/3 Unsupported function: ");
+    ASSERT_TRUE(rc == -1 && errno == EINVAL, "");
+
+    rc = modbus_set_reply_handler(ctx, MODBUS_FC_READ_INPUT_REGISTERS, NULL, NULL);
+    printf("2/3 Remove a handler: ");
+    ASSERT_TRUE(rc == 0, "");
+
+    printf("3/3 Defer outside of a handler: ");
+    ASSERT_TRUE(modbus_reply_defer(ctx) == NULL && errno == EINVAL, "");
+    modbus_free(ctx);
+    ctx = NULL;
+
+    printf("\nTEST SHARED MAPPING:\n");
+    {
+        const char *name = "/libmodbus-unit-test";
+        modbus_mapping_t *mb_mapping;
+        modbus_mapping_t *mb_mapping_attached;
+        uint32_t *header;
+        int fd;
+
+        modbus_mapping_unlink_shm(name);
+        mb_mapping = modbus_mapping_new_shm(name, 0, 0, 0, 0, 100, 10, 0, 0, 0);
+        mb_mapping_attached = modbus_mapping_attach_shm(name);
+        printf("1/4 Attach to the region: ");
+        ASSERT_TRUE(mb_mapping != NULL && mb_mapping_attached != NULL &&
+                        mb_mapping_attached->start_registers == 100 &&
+                        mb_mapping_attached->nb_registers == 10,
+                    "");
+
+        mb_mapping->tab_registers[9] = 0x1234;
+        printf("2/4 Values shared by the mappings: ");
+        ASSERT_TRUE(mb_mapping_attached->tab_registers[9] == 0x1234, "");
+        modbus_mapping_free(mb_mapping_attached);
+
+        /* Header of the region (modbus-private.h): magic, version, size, flags,
+           seq, start[4], nb[4] and offset[4] */
+        fd = shm_open(name, O_RDWR, 0);
+        header = (uint32_t *) mmap(NULL, 64, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (header != MAP_FAILED)
+            header[3] = 0x80000000;
+        mb_mapping_attached = modbus_mapping_attach_shm(name);
+        printf("3/4 Reject unknown options: ");
+        ASSERT_TRUE(header != MAP_FAILED && mb_mapping_attached == NULL &&
+                        errno == EINVAL,
+                    "");
+
+        /* Registers past the end of the region */
+        header[3] = 0;
+        header[9 + MODBUS_TABLE_REGISTERS] = 60000;
+        mb_mapping_attached = modbus_mapping_attach_shm(name);
+        printf("4/4 Reject tables outside of the region: ");
+        ASSERT_TRUE(mb_mapping_attached == NULL && errno == EINVAL, "");
+        munmap(header, 64);
+
+        modbus_mapping_free(mb_mapping);
+        modbus_mapping_unlink_shm(name);
+    }
+
     printf("\nALL TESTS PASS WITH SUCCESS.\n");
     success = TRUE;
 
@@ -26,12 +26,198 @@
 
 #include "unit-test.h"
 
+#ifdef UT_ENGINE_PORT
+#include <pthread.h>
+#endif
+
 enum {
     TCP,
     TCP_PI,
     RTU
 };
 
+#ifdef UT_ENGINE_PORT
+/* Registers of the handlers of the server engine */
+static uint16_t handler_registers[UT_HANDLER_REGISTERS_NB];
+
+/* Reads of input registers deferred by their handler, completed in order by
+   another thread */
+#define NB_DEFERRED_MAX 16
+typedef struct {
+    modbus_deferred_t *deferred;
+    int addr;
+    int nb;
+} deferred_read_t;
+static deferred_read_t deferred_reads[NB_DEFERRED_MAX];
+static int nb_deferred_reads = 0;
+static pthread_mutex_t deferred_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t deferred_cond = PTHREAD_COND_INITIALIZER;
+
+static int read_registers_handler(modbus_t *ctx,
+                                  int function,
+                                  int addr,
+                                  int nb,
+                                  const uint8_t *values,
+                                  uint8_t *dest,
+                                  void *user_data)
+{
+    int i;
+
+    (void) ctx;
+    (void) function;
+    (void) values;
+    (void) user_data;
+
+    if (addr + nb > UT_HANDLER_REGISTERS_NB)
+        return MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+
+    for (i = 0; i < nb; i++) {
+        MODBUS_SET_INT16_TO_INT8(dest, i * 2, handler_registers[addr + i]);
+    }
+
+    return 0;
+}
+
+static int write_registers_handler(modbus_t *ctx,
+                                   int function,
+                                   int addr,
+                                   int nb,
+                                   const uint8_t *values,
+                                   uint8_t *dest,
+                                   void *user_data)
+{
+    int i;
+
+    (void) ctx;
+    (void) function;
+    (void) dest;
+    (void) user_data;
+
+    if (addr + nb > UT_HANDLER_REGISTERS_NB)
+        return MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+
+    for (i = 0; i < nb; i++) {
+        handler_registers[addr + i] = MODBUS_GET_INT16_FROM_INT8(values, i * 2);
+    }
+
+    return 0;
+}
+
+/* The input registers have the values of the registers, their responses are
+   deferred */
+static int read_input_registers_handler(modbus_t *ctx,
+                                        int function,
+                                        int addr,
+                                        int nb,
+                                        const uint8_t *values,
+                                        uint8_t *dest,
+                                        void *user_data)
+{
+    modbus_deferred_t *deferred;
+
+    (void) function;
+    (void) values;
+    (void) dest;
+    (void) user_data;
+
+    if (addr + nb > UT_HANDLER_REGISTERS_NB)
+        return MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+
+    deferred = modbus_reply_defer(ctx);
+    if (deferred == NULL)
+        return MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE;
+
+    pthread_mutex_lock(&deferred_mutex);
+    if (nb_deferred_reads == NB_DEFERRED_MAX) {
+        pthread_mutex_unlock(&deferred_mutex);
+        modbus_deferred_reply(deferred, MODBUS_EXCEPTION_SLAVE_OR_SERVER_BUSY);
+        return 0;
+    }
+    deferred_reads[nb_deferred_reads].deferred = deferred;
+    deferred_reads[nb_deferred_reads].addr = addr;
+    deferred_reads[nb_deferred_reads].nb = nb;
+    nb_deferred_reads++;
+    pthread_cond_signal(&deferred_cond);
+    pthread_mutex_unlock(&deferred_mutex);
+
+    return 0;
+}
+
+static void *complete_deferred_reads(void *arg)
+{
+    (void) arg;
+
+    for (;;) {
+        deferred_read_t read;
+        uint8_t *dest;
+        int i;
+
+        pthread_mutex_lock(&deferred_mutex);
+        while (nb_deferred_reads == 0)
+            pthread_cond_wait(&deferred_cond, &deferred_mutex);
+        read = deferred_reads[0];
+        nb_deferred_reads--;
+        memmove(deferred_reads,
+                deferred_reads + 1,
+                nb_deferred_reads * sizeof(deferred_read_t));
+        pthread_mutex_unlock(&deferred_mutex);
+
+        /* Slower than the requests replied by the engine meanwhile */
+        usleep(100000);
+
+        dest = modbus_deferred_get_dest(read.deferred);
+        for (i = 0; i < read.nb; i++) {
+            MODBUS_SET_INT16_TO_INT8(dest, i * 2, handler_registers[read.addr + i]);
+        }
+        modbus_deferred_reply(read.deferred, 0);
+    }
+
+    return NULL;
+}
+
+/* Replies by handlers on the engine port until the end of the process */
+static void *run_engine(void *arg)
+{
+    modbus_t *ctx;
+    modbus_mapping_t *mb_mapping;
+    modbus_server_t *server;
+    pthread_t thread;
+    int s;
+
+    (void) arg;
+
+    if (pthread_create(&thread, NULL, complete_deferred_reads, NULL) == 0)
+        pthread_detach(thread);
+
+    ctx = modbus_new_tcp("127.0.0.1", UT_ENGINE_PORT);
+    mb_mapping = modbus_mapping_new(0, 0, 0, 0);
+    modbus_set_reply_handler(
+        ctx, MODBUS_FC_READ_HOLDING_REGISTERS, read_registers_handler, NULL);
+    modbus_set_reply_handler(
+        ctx, MODBUS_FC_WRITE_SINGLE_REGISTER, write_registers_handler, NULL);
+    modbus_set_reply_handler(
+        ctx, MODBUS_FC_WRITE_MULTIPLE_REGISTERS, write_registers_handler, NULL);
+    modbus_set_reply_handler(
+        ctx, MODBUS_FC_READ_INPUT_REGISTERS, read_input_registers_handler, NULL);
+
+    s = modbus_tcp_listen(ctx, 1);
+    server = modbus_server_new(ctx, s, mb_mapping);
+    if (server == NULL) {
+        fprintf(stderr, "Unable to create the engine: %s\n", modbus_strerror(errno));
+    } else {
+        modbus_server_run(server);
+        modbus_server_free(server);
+    }
+
+    if (s != -1)
+        close(s);
+    modbus_mapping_free(mb_mapping);
+    modbus_free(ctx);
+
+    return NULL;
+}
+#endif
+
 int main(int argc, char *argv[])
 {
     int s = -1;
@@ -122,6 +308,15 @@ int main(int argc, char *argv[])
         mb_mapping->tab_input_registers[i] = UT_INPUT_REGISTERS_TAB[i];
     }
 
+#ifdef UT_ENGINE_PORT
+    if (use_backend == TCP) {
+        pthread_t engine_thread;
+
+        if (pthread_create(&engine_thread, NULL, run_engine, NULL) == 0)
+            pthread_detach(engine_thread);
+    }
+#endif
+
     if (use_backend == TCP) {
         s = modbus_tcp_listen(ctx, 1);
         modbus_tcp_accept(ctx, &s);